@@ -18,72 +18,293 @@
 extern PlaydateAPI *pd;
 #endif
 
+#if ECS_THREADS
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#define ECS_ATOMIC(T)       _Atomic T
+#define atomicLoad(ptr)     atomic_load_explicit((ptr), memory_order_acquire)
+#define atomicStore(ptr, v) atomic_store_explicit((ptr), (v), memory_order_release)
+#define atomicAdd(ptr, v)   atomic_fetch_add_explicit((ptr), (v), memory_order_acq_rel)
+#define atomicSwap(ptr, v)  atomic_exchange_explicit((ptr), (v), memory_order_acq_rel)
+#define atomicCAS(ptr, expected, v)                                                             \
+    atomic_compare_exchange_weak_explicit((ptr), (expected), (v),                               \
+                                          memory_order_acq_rel, memory_order_acquire)
+#define bitsOr(ptr, v)      __atomic_fetch_or((ptr), (v), __ATOMIC_RELAXED)
+#define bitsOrOld(ptr, v)   __atomic_fetch_or((ptr), (v), __ATOMIC_RELAXED)
+#define bitsAnd(ptr, v)     __atomic_fetch_and((ptr), (v), __ATOMIC_RELAXED)
+#define bitsLoad(ptr)       __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#else
+#define ECS_ATOMIC(T)       T
+#define atomicLoad(ptr)     (*(ptr))
+#define atomicStore(ptr, v) (*(ptr) = (v))
+#define atomicAdd(ptr, v)   ((*(ptr) += (v)) - (v))
+#define atomicSwap(ptr, v)  swapImpl((ptr), (v))
+#define atomicCAS(ptr, expected, v) casImpl((ptr), (expected), (v))
+#define bitsOr(ptr, v)      (*(ptr) |= (v))
+#define bitsOrOld(ptr, v)   orImpl((ptr), (v))
+#define bitsAnd(ptr, v)     (*(ptr) &= (v))
+#define bitsLoad(ptr)       (*(ptr))
+
+static inline uint8_t swapImpl(uint8_t *ptr, uint8_t value) {
+    uint8_t old = *ptr;
+    *ptr = value;
+    return old;
+}
+
+static inline uint64_t orImpl(uint64_t *ptr, uint64_t value) {
+    uint64_t old = *ptr;
+    *ptr |= value;
+    return old;
+}
+
+static inline bool casImpl(uint32_t *ptr, uint32_t *expected, uint32_t value) {
+    if(*ptr != *expected) {
+        *expected = *ptr;
+        return false;
+    }
+    *ptr = value;
+    return true;
+}
+#endif
+
+#if ECS_THREADS
+#define ECS_THREAD_LOCAL    _Thread_local
+#else
+#define ECS_THREAD_LOCAL
+#endif
+
+#define ECS_BITMAP_WORDS    (1 + (ECS_MAX_ENTITIES-1)/64)
+
+// Pools hand out indices from their free list first, then past the highest index used so far. An
+// empty pool can be reset without touching its free list.
 #define DECLARE_POOL(T, name, count)                        \
 typedef struct {                                            \
-    uint16_t freeCount;                                     \
-    uint16_t freeList[count];                               \
+    ECS_ATOMIC(uint32_t) freeCount;                         \
+    ECS_ATOMIC(uint32_t) nextUnused;                        \
+    Index freeList[count];                                  \
     T data[count];                                          \
 } name##Pool;                                               \
                                                             \
                                                             \
 void init##name##Pool(name##Pool *pool) {                   \
-    pool->freeCount = count;                                \
+    pool->freeCount = 0;                                    \
+    pool->nextUnused = 0;                                   \
     memset(pool->data, 0, count * sizeof(T));               \
-    for(uint16_t i = 0; i < count; ++i) {                   \
-        pool->freeList[i] = count - (i+1);                  \
-    }                                                       \
 }                                                           \
                                                             \
                                                             \
                                                             \
-uint16_t new##name##FromPool(name##Pool *pool) {            \
-    ASSERT(pool->freeCount);                                \
-    uint16_t id = pool->freeList[--pool->freeCount];        \
-    return id;                                              \
+Index new##name##FromPool(name##Pool *pool) {               \
+    if(pool->freeCount) {                                   \
+        return pool->freeList[--pool->freeCount];           \
+    }                                                       \
+    ASSERT(pool->nextUnused < count);                       \
+    return pool->nextUnused++;                              \
 }\
                                                             \
-void return##name##ToPool(name##Pool *pool, uint16_t id) {  \
+void return##name##ToPool(name##Pool *pool, Index id) {     \
     ASSERT(pool->freeCount < count);                        \
     pool->freeList[pool->freeCount++] = id;                 \
+}                                                           \
+                                                            \
+void reset##name##Pool(name##Pool *pool) {                  \
+    pool->freeCount = 0;                                    \
+    pool->nextUnused = 0;                                   \
 }
 
 
-typedef enum {
-    kEntityUnused = 1 << 0,
-} EntityFlags;
-
 typedef struct {
-    uint32_t        info;
+    Generation      generation;
     ComponentMask   components;
+#if ECS_INLINE_BYTES
+    _Alignas(8) uint8_t inlineData[ECS_INLINE_BYTES];
+#endif
 } EntityData;
 
+// Triple buffer for a component's table. `stale` holds, for each copy, the rows that were
+// written since that copy was last the one being written to.
+typedef struct {
+    uint8_t         *data[3];
+    uint64_t        present[3][ECS_BITMAP_WORDS];
+    uint64_t        stale[3][ECS_BITMAP_WORDS];
+} Snapshot;
+
+enum {
+    kSnapshotIndex = 0x03,
+    kSnapshotFresh = 0x04,
+};
+
 typedef struct {
-    size_t          size;
     char            id[64];
-    uint8_t         data[];
+    size_t          size;
+} ComponentType;
+
+typedef struct {
+    uint32_t        key;
+    uint32_t        slot;
+} HashBucket;
+
+// When each entity's row was last written or removed, for the features that read changes back:
+// extraction, replication and journals. `removed` holds the generation an entity had when its
+// row was first removed since the last extraction, and `unextracted` which of those removals
+// haven't been extracted yet.
+typedef struct {
+    uint32_t        changed[ECS_MAX_ENTITIES];
+    Generation      removed[ECS_MAX_ENTITIES];
+    uint64_t        unextracted[ECS_BITMAP_WORDS];
+} ChangeLog;
+
+// Tables' rows are indexed by entity. Sparse sets, hash maps and tables owned by a group are
+// packed: `slotOf` or `buckets` map an entity to its row, and `entityAt` maps rows back to
+// entities. Tags are tables with empty rows. Inline components live in the entity table, so
+// their rows are `sizeof(EntityData)` apart. Bit-packed components have empty rows too, and keep
+// their values in `bits`. `present` has a bit set for each entity that has the component.
+// `version` changes whenever rows move or go away, which invalidates component references.
+// `changes` is only allocated once the registry tracks changes, so that rare components don't
+// pay for it.
+typedef struct {
+    size_t          size;
+    size_t          stride;
+    uint8_t         *data;
+    Snapshot        *snapshot;
+    uint8_t         storage;
+    Index           *slotOf;
+    HashBucket      *buckets;
+    uint32_t        bucketCount;
+    Index           *entityAt;
+    uint32_t        count;
+    uint32_t        capacity;
+    uint8_t         group;
+    uint64_t        *bits;
+    uint8_t         bitWidth;
+    uint32_t        version;
+    uint64_t        present[ECS_BITMAP_WORDS];
+    ChangeLog       *changes;
+    uint8_t         table[];
 } ComponentData;
 
 typedef struct {
+    Entity          entity;
+    uint16_t        size;
     ECSID           id;
+    uint8_t         present;
+} PacketHeader;
+
+struct ECSPacket {
+    size_t          count;
+    size_t          size;
+    size_t          capacity;
+    uint8_t         *data;
+};
+
+// The entities that have all of a group's components are kept at the front of each component's
+// table, in the same order.
+typedef struct {
+    ComponentMask   owned;
+    uint8_t         compCount;
+    uint8_t         comps[ECS_MAX_COMPS];
+    uint32_t        size;
+} Group;
+
+typedef struct {
+    uint32_t        generation;
     ComponentMask   mask;
     ECSIterator     *func;
     void            *userData;
+    uint32_t        phases;
+    bool            parallel;
+    bool            enabled;
+    bool            alive;
 } System;
 
+enum {
+    kCommandDestroy = 0,
+    kCommandAdd     = 1,
+    kCommandRemove  = 2,
+};
+
+typedef struct {
+    Entity          entity;
+    uint16_t        size;
+    uint8_t         kind;
+    ECSID           id;
+} CommandHeader;
+
+typedef struct {
+    size_t          size;
+    size_t          capacity;
+    uint8_t         *data;
+} ByteBuffer;
+
 DECLARE_POOL(EntityData, Entity, ECS_MAX_ENTITIES);
 DECLARE_POOL(System, System, ECS_MAX_SYSTEMS);
 
 
+// Cached hash of each row of a component table (or of the entity table, in the last slot), and
+// the rows that changed since the world hash was last brought up to date.
+typedef struct {
+    uint64_t        rows[ECS_MAX_ENTITIES];
+    uint64_t        dirty[ECS_BITMAP_WORDS];
+} HashSlot;
+
+typedef struct {
+    uint8_t         slot;
+    Index           id;
+} DirtyRow;
+
+enum {
+    kHashEntitySlot = ECS_MAX_COMPS,
+};
+
+// Component types are shared by every registry in the process, so that IDs and masks are the same
+// in all of them.
+static ComponentType        types[ECS_MAX_COMPS];
+static ECS_ATOMIC(uint8_t)  typeCount = 0;
+#if ECS_THREADS
+static pthread_mutex_t      typeLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 struct ECS {
     EntityPool      entities;
+    uint64_t        alive[ECS_BITMAP_WORDS];
     
-    uint8_t         compDataCount;
     ComponentData   *compData[ECS_MAX_COMPS];
+    Group           groups[ECS_MAX_COMPS];
+    uint8_t         groupCount;
+    ComponentMask   ownedComponents;
+    uint8_t         inlineBytes;
     
-    uint8_t         nextSystemID;
-    uint8_t         systemCount;
-    System          systems[ECS_MAX_SYSTEMS];
-//    SystemPool      systems;
+    SystemPool      systems;
+    ECSSystem       systemOrder[ECS_MAX_SYSTEMS];
+    uint8_t         systemOrderCount;
+    const System    *activeSystems[ECS_MAX_SYSTEMS];
+    uint8_t         activeSystemCount;
+    bool            systemsDirty;
+    bool            fuseSystems;
+    
+    ByteBuffer      commands;
+    ByteBuffer      *chunkCommands;
+    uint32_t        chunkCommandCount;
+    ECSWorkerPool   *pool;
+    bool            deterministic;
+    
+    ECSJournal      *journal;
+    
+    uint32_t        tick;
+    uint32_t        lastExtract;
+    bool            tracking;
+    
+    bool            hashing;
+    uint64_t        hash;
+    HashSlot        *hashSlots[ECS_MAX_COMPS + 1];
+    DirtyRow        *dirtyRows;
+    ECS_ATOMIC(uint32_t) dirtyCount;
+    
+    bool            hasSnapshots;
+    uint8_t         snapWrite;
+    uint8_t         snapRead;
+    ECS_ATOMIC(uint8_t) snapMiddle;
 };
 
 
@@ -100,25 +321,159 @@ void assertImpl(const char *file, int line, const char *exprStr, bool expr) {
 
 // MARK: - Handle Utilities
 
-static inline uint8_t generation(EntityData data) {
-    return data.info & 0xffff;
-}
-
-static inline uint16_t flags(EntityData data) {
-    return (data.info >> 16) & 0xffff;
+static inline Generation generation(EntityData data) {
+    return data.generation;
 }
 
-static inline Entity createHandle(uint16_t index, uint8_t generation) {
-    return ((Entity)generation << 16) | ((Entity)index);
+static inline Entity createHandle(Index index, Generation generation) {
+    return ((Entity)generation << ECS_INDEX_BITS) | ((Entity)index);
 }
 
-static inline EntityData createEntityData(uint8_t generation) {
+static inline EntityData createEntityData(Generation generation) {
     return (EntityData) {
-        .info = generation,
+        .generation = generation & ECS_GEN_MASK,
         .components = 0
     };
 }
 
+static inline void bitSet(uint64_t *words, Index bit) {
+    bitsOr(&words[bit / 64], (uint64_t)1 << (bit % 64));
+}
+
+static inline void bitClear(uint64_t *words, Index bit) {
+    bitsAnd(&words[bit / 64], ~((uint64_t)1 << (bit % 64)));
+}
+
+static inline bool bitTestAndSet(uint64_t *words, Index bit) {
+    uint64_t mask = (uint64_t)1 << (bit % 64);
+    return (bitsOrOld(&words[bit / 64], mask) & mask) != 0;
+}
+
+static inline bool bitTest(const uint64_t *words, Index bit) {
+    return (bitsLoad(&words[bit / 64]) >> (bit % 64)) & 1;
+}
+
+static inline uint32_t hashBucket(const ComponentData *comp, Index id) {
+    return (id * 2654435761u) & (comp->bucketCount - 1);
+}
+
+static uint32_t findHashSlot(const ComponentData *comp, Index id) {
+    uint32_t bucket = hashBucket(comp, id);
+    while(comp->buckets[bucket].key != (uint32_t)id + 1) {
+        ASSERT(comp->buckets[bucket].key != 0);
+        bucket = (bucket + 1) & (comp->bucketCount - 1);
+    }
+    return comp->buckets[bucket].slot;
+}
+
+static inline uint8_t *componentRow(const ComponentData *comp, Index index) {
+    if(comp->slotOf) {
+        index = comp->slotOf[index];
+    } else if(comp->buckets) {
+        index = findHashSlot(comp, index);
+    }
+    return comp->data + index * comp->stride;
+}
+
+// Returns the entities of one word of the entity bitmap that have every component of a mask.
+static inline uint64_t matchingEntities(const ECS *ecs, ComponentMask mask, uint32_t word) {
+    uint64_t bits = ecs->alive[word];
+    while(mask && bits) {
+        const ComponentData *comp = ecs->compData[__builtin_ctz(mask)];
+        bits = comp ? bits & comp->present[word] : 0;
+        mask &= mask - 1;
+    }
+    return bits;
+}
+
+// Walks the entity bitmap a few entities ahead of an iteration loop, prefetching the rows of the
+// entities that match its mask. Hardware prefetchers can't follow sparse iteration on their own.
+typedef struct {
+    const ECS           *ecs;
+    ComponentMask       mask;
+    uint8_t             compCount;
+    const ComponentData *comps[ECS_MAX_COMPS];
+    uint32_t            word;
+    uint32_t            lastWord;
+    uint64_t            bits;
+} Prefetcher;
+
+#if ECS_PREFETCH_DISTANCE
+static void prefetchNext(Prefetcher *p) {
+    while(!p->bits) {
+        if(++p->word >= p->lastWord) return;
+        p->bits = matchingEntities(p->ecs, p->mask, p->word);
+    }
+    Index id = p->word * 64 + __builtin_ctzll(p->bits);
+    p->bits &= p->bits - 1;
+    
+    // Systems may have removed components from entities since their word was matched.
+    if((p->ecs->entities.data[id].components & p->mask) != p->mask) return;
+    for(uint8_t i = 0; i < p->compCount; ++i) {
+        __builtin_prefetch(componentRow(p->comps[i], id), 1);
+    }
+}
+
+static void initPrefetcher(Prefetcher *p, const ECS *ecs, ComponentMask mask, uint32_t first, uint32_t last) {
+    p->ecs = ecs;
+    p->mask = mask;
+    p->compCount = 0;
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        // Finding a row in a hash map costs as much as reading it, and tags and bit-packed
+        // components have no rows.
+        const ComponentData *comp = ecs->compData[i];
+        if(!(mask & (1 << i)) || !comp || !comp->size || comp->storage == kStorageHash) continue;
+        p->comps[p->compCount++] = comp;
+    }
+    p->word = first;
+    p->lastWord = last;
+    p->bits = first < last ? matchingEntities(ecs, mask, first) : 0;
+    for(uint32_t i = 0; i < ECS_PREFETCH_DISTANCE; ++i) prefetchNext(p);
+}
+#else
+static inline void prefetchNext(Prefetcher *p) { (void)p; }
+static inline void initPrefetcher(Prefetcher *p, const ECS *ecs, ComponentMask mask, uint32_t first, uint32_t last) {
+    (void)p; (void)ecs; (void)mask; (void)first; (void)last;
+}
+#endif
+
+// Makes room for `size` more bytes at the end of a buffer, and returns where to write them.
+static uint8_t *appendBytes(ByteBuffer *buffer, size_t size) {
+    if(buffer->size + size > buffer->capacity) {
+        while(buffer->size + size > buffer->capacity) {
+            buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+        }
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    uint8_t *bytes = buffer->data + buffer->size;
+    buffer->size += size;
+    return bytes;
+}
+
+static void writeByte(ByteBuffer *buffer, uint8_t byte) {
+    *appendBytes(buffer, 1) = byte;
+}
+
+static void writeVarint(ByteBuffer *buffer, uint32_t value) {
+    while(value >= 0x80) {
+        writeByte(buffer, (value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    writeByte(buffer, value);
+}
+
+static uint32_t readVarint(const uint8_t **cursor) {
+    uint32_t value = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+    do {
+        byte = *(*cursor)++;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while(byte & 0x80);
+    return value;
+}
+
 ComponentMask componentMask(unsigned count, ...) {
     ComponentMask mask = 0;
     
@@ -137,149 +492,2160 @@ ComponentMask componentMask(unsigned count, ...) {
 ECS *newECS(void) {
     ECS *ecs = malloc(sizeof(*ecs));
     ecs->entities.freeCount = ECS_MAX_ENTITIES;
-    ecs->compDataCount = 0;
+    memset(ecs->compData, 0, sizeof(ecs->compData));
+    ecs->groupCount = 0;
+    ecs->ownedComponents = 0;
+    ecs->inlineBytes = 0;
+    memset(ecs->alive, 0, sizeof(ecs->alive));
     
-    ecs->systemCount = 0;
-    ecs->nextSystemID = 0;
+    initSystemPool(&ecs->systems);
+    ecs->systemOrderCount = 0;
+    ecs->activeSystemCount = 0;
+    ecs->systemsDirty = false;
+    ecs->fuseSystems = false;
     initEntityPool(&ecs->entities);
+    
+    ecs->commands = (ByteBuffer){ 0 };
+    ecs->chunkCommands = NULL;
+    ecs->chunkCommandCount = 0;
+    ecs->pool = NULL;
+    ecs->deterministic = false;
+    
+    ecs->journal = NULL;
+    
+    ecs->tick = 1;
+    ecs->lastExtract = 0;
+    ecs->tracking = false;
+    
+    ecs->hashing = false;
+    ecs->hash = 0;
+    memset(ecs->hashSlots, 0, sizeof(ecs->hashSlots));
+    ecs->dirtyRows = NULL;
+    ecs->dirtyCount = 0;
+    
+    ecs->hasSnapshots = false;
+    ecs->snapWrite = 0;
+    ecs->snapMiddle = 1;
+    ecs->snapRead = 2;
     return ecs;
 }
 
 void destroyECS(ECS *ecs) {
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        if(!ecs->compData[i]) continue;
+        Snapshot *snap = ecs->compData[i]->snapshot;
+        if(snap) {
+            // One of the copies is the component's own table, depending on when it was buffered.
+            for(uint8_t c = 0; c < 3; ++c) {
+                if(snap->data[c] != ecs->compData[i]->table) free(snap->data[c]);
+            }
+            free(snap);
+        }
+        uint8_t storage = ecs->compData[i]->storage;
+        if(storage == kStorageSparse || storage == kStorageHash) free(ecs->compData[i]->data);
+        free(ecs->compData[i]->slotOf);
+        free(ecs->compData[i]->buckets);
+        free(ecs->compData[i]->bits);
+        free(ecs->compData[i]->entityAt);
+        free(ecs->compData[i]->changes);
+        free(ecs->compData[i]);
+    }
+    for(uint8_t i = 0; i <= ECS_MAX_COMPS; ++i) {
+        free(ecs->hashSlots[i]);
+    }
+    free(ecs->dirtyRows);
+    for(uint32_t i = 0; i < ecs->chunkCommandCount; ++i) {
+        free(ecs->chunkCommands[i].data);
+    }
+    free(ecs->chunkCommands);
+    free(ecs->commands.data);
     free(ecs);
 }
 
 // MARK: - Component Handling
 
-uint8_t ecsComponentID(const ECS *ecs, const char *id) {
-    for(uint8_t i = 0; i < ecs->compDataCount; ++i) {
-        if(!strcmp(ecs->compData[i]->id, id)) return i;
+static uint8_t findComponentType(const char *id) {
+    uint8_t count = atomicLoad(&typeCount);
+    for(uint8_t i = 0; i < count; ++i) {
+        if(!strcmp(types[i].id, id)) return i;
     }
     return ECS_MAX_COMPS;
 }
 
-uint8_t ecsDeclareComponent(ECS *ecs, const char *compID, size_t size) {
-    uint8_t id = ecsComponentID(ecs, compID);
-    if(id != ECS_MAX_COMPS) return id;
-    ASSERT(ecs->compDataCount < ECS_MAX_COMPS);
+uint8_t ecsRegisterComponent(const char *compID, size_t size) {
+    uint8_t id = findComponentType(compID);
+    if(id != ECS_MAX_COMPS) {
+        ASSERT(types[id].size == size);
+        return id;
+    }
+    
+#if ECS_THREADS
+    pthread_mutex_lock(&typeLock);
+    id = findComponentType(compID);
+    if(id != ECS_MAX_COMPS) {
+        pthread_mutex_unlock(&typeLock);
+        return id;
+    }
+#endif
+    id = typeCount;
+    ASSERT(id < ECS_MAX_COMPS);
+    ASSERT(strlen(compID) < sizeof(types[id].id));
+    strcpy(types[id].id, compID);
+    types[id].size = size;
+    atomicStore(&typeCount, id + 1);
+#if ECS_THREADS
+    pthread_mutex_unlock(&typeLock);
+#endif
+    return id;
+}
+
+uint8_t ecsComponentID(const ECS *ecs, const char *id) {
+    (void)ecs;
+    return findComponentType(id);
+}
+
+static ComponentData *createComponent(ECS *ecs, uint8_t compID, ECSStorage storage,
+                                      uint8_t bitWidth) {
+    ASSERT(compID < atomicLoad(&typeCount));
+    size_t size = storage == kStorageTag || storage == kStorageBits ? 0 : types[compID].size;
+    size_t tableSize = storage == kStorageTable ? ECS_MAX_ENTITIES * size : 0;
     
-    ComponentData *data = malloc(sizeof(ComponentData) + ECS_MAX_ENTITIES * size);
-    strcpy(data->id, compID);
+    ComponentData *data = malloc(sizeof(ComponentData) + tableSize);
     data->size = size;
-    memset(data->data, 0, ECS_MAX_ENTITIES * size);
-    ecs->compData[ecs->compDataCount] = data;
-    return ecs->compDataCount++;
+    data->stride = size;
+    data->data = data->table;
+    data->snapshot = NULL;
+    data->storage = storage;
+    data->slotOf = NULL;
+    data->buckets = NULL;
+    data->bucketCount = 0;
+    data->entityAt = NULL;
+    data->count = 0;
+    data->capacity = 0;
+    data->group = ECS_MAX_COMPS;
+    data->bits = NULL;
+    data->bitWidth = 0;
+    data->version = 1;
+    memset(data->present, 0, sizeof(data->present));
+    data->changes = ecs->tracking ? calloc(1, sizeof(ChangeLog)) : NULL;
+    memset(data->data, 0, tableSize);
+    
+    if(storage == kStorageSparse) {
+        data->slotOf = malloc(ECS_MAX_ENTITIES * sizeof(Index));
+    }
+    if(storage == kStorageHash) {
+        data->bucketCount = 16;
+        data->buckets = calloc(data->bucketCount, sizeof(HashBucket));
+    }
+    if(storage == kStorageSparse || storage == kStorageHash) {
+        data->data = NULL;
+    }
+    if(storage == kStorageBits) {
+        // Values never straddle two words.
+        data->bitWidth = bitWidth;
+        ASSERT(data->bitWidth && data->bitWidth <= 8 && !(data->bitWidth & (data->bitWidth - 1)));
+        data->bits = calloc(ECS_BITMAP_WORDS * data->bitWidth, sizeof(uint64_t));
+    }
+#if ECS_INLINE_BYTES
+    if(storage == kStorageInline) {
+        // Rows are aligned like the largest power of two that divides their size, up to 8 bytes.
+        size_t align = size & -size;
+        if(align > 8) align = 8;
+        size_t offset = (ecs->inlineBytes + align - 1) & ~(align - 1);
+        ASSERT(offset + size <= ECS_INLINE_BYTES);
+        ecs->inlineBytes = offset + size;
+        data->stride = sizeof(EntityData);
+        data->data = ecs->entities.data[0].inlineData + offset;
+    }
+#else
+    ASSERT(storage != kStorageInline);
+#endif
+    
+    ecs->compData[compID] = data;
+    if(ecs->hashing) ecs->hashSlots[compID] = calloc(1, sizeof(HashSlot));
+    return data;
+}
+
+// Starts tracking changes to every component type. Rows that are already there count as written
+// now, since nothing has read them back yet.
+static void trackChanges(ECS *ecs) {
+    if(ecs->tracking) return;
+    ecs->tracking = true;
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        ComponentData *comp = ecs->compData[i];
+        if(!comp) continue;
+        comp->changes = calloc(1, sizeof(ChangeLog));
+        for(uint32_t id = 0; id < ECS_MAX_ENTITIES; ++id) {
+            if(ecs->entities.data[id].components & (1 << i)) comp->changes->changed[id] = ecs->tick;
+        }
+    }
+}
+
+// Returns the storage for a component type in a registry, creating a table the first time the
+// type is used there.
+static ComponentData *worldComponent(ECS *ecs, uint8_t compID) {
+    if(ecs->compData[compID]) return ecs->compData[compID];
+    return createComponent(ecs, compID, kStorageTable, 0);
+}
+
+uint8_t ecsDeclareComponent(ECS *ecs, const char *compID, size_t size) {
+    return ecsDeclareComponentStorage(ecs, compID, size, kStorageTable);
+}
+
+uint8_t ecsDeclareComponentStorage(ECS *ecs, const char *compID, size_t size, ECSStorage storage) {
+    // The type itself is shared by every registry, so it doesn't know about bit widths: bit-packed
+    // values are read and written as bytes.
+    uint8_t id = ecsRegisterComponent(compID, storage == kStorageBits ? sizeof(uint8_t) : size);
+    if(ecs->compData[id]) {
+        ASSERT(ecs->compData[id]->storage == storage);
+    } else {
+        createComponent(ecs, id, storage, storage == kStorageBits ? size : 0);
+    }
+    return id;
+}
+
+// Returns how many bytes a row of the given type takes in a registry, which is 0 for tags and
+// bit-packed components.
+static size_t rowSize(const ECS *ecs, uint8_t compID) {
+    return ecs->compData[compID] ? ecs->compData[compID]->size : types[compID].size;
 }
 
 // MARK: - Entity Handling
 
+static void markWritten(ECS *ecs, uint8_t compID, Index id, bool present);
+static void markHashDirty(ECS *ecs, uint8_t slot, Index id);
+static void journalRecord(ECS *ecs, uint8_t kind, uint32_t id, uint32_t arg);
+static void attachRow(ComponentData *comp, Index id);
+static void detachRow(ComponentData *comp, Index id);
+static void joinGroups(ECS *ecs, Index id, ComponentMask added);
+static void leaveGroups(ECS *ecs, Index id, ComponentMask removed);
+static System *findSystem(ECS *ecs, ECSSystem handle);
+static void updateSystems(ECS *ecs);
+
+enum {
+    kJournalType          = 0,
+    kJournalCreate        = 1,
+    kJournalDestroy       = 2,
+    kJournalClear         = 3,
+    kJournalAdd           = 4,
+    kJournalRemove        = 5,
+    kJournalWrite         = 6,
+    kJournalSystem        = 7,
+    kJournalTick          = 8,
+    kJournalRunTick       = 9,
+    kJournalPhase         = 10,
+    kJournalEnable        = 11,
+    kJournalDestroySystem = 12,
+};
+
+// Takes `count` indices off the top of the free list in one go, or failing that past the highest
+// index used so far. Only ever shrinks the free list, so it is safe to race against other claims,
+// but not against entities being returned to the pool. That is also why it never takes part of the
+// claim from each: indices taken off the free list could not be put back if the rest then failed.
+static bool claimEntities(EntityPool *pool, uint32_t count, Entity *ids) {
+    uint32_t freeCount = atomicLoad(&pool->freeCount);
+    while(freeCount >= count) {
+        if(!atomicCAS(&pool->freeCount, &freeCount, freeCount - count)) continue;
+        for(uint32_t i = 0; i < count; ++i) {
+            ids[i] = pool->freeList[freeCount - (i+1)];
+        }
+        return true;
+    }
+    
+    uint32_t next = atomicLoad(&pool->nextUnused);
+    while(next + count <= ECS_MAX_ENTITIES) {
+        if(!atomicCAS(&pool->nextUnused, &next, next + count)) continue;
+        for(uint32_t i = 0; i < count; ++i) {
+            ids[i] = next + i;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool reserveEntities(ECS *ecs, uint32_t count, Entity *entities) {
+    if(!claimEntities(&ecs->entities, count, entities)) return false;
+    
+    for(uint32_t i = 0; i < count; ++i) {
+        Index id = entities[i];
+        Generation gen = generation(ecs->entities.data[id]);
+        ecs->entities.data[id] = createEntityData(gen);
+        bitSet(ecs->alive, id);
+        if(ecs->hashing) markHashDirty(ecs, kHashEntitySlot, id);
+        if(ecs->journal) journalRecord(ecs, kJournalCreate, id, gen);
+        entities[i] = createHandle(id, gen);
+    }
+    return true;
+}
+
 Entity newEntity(ECS *ecs) {
-    if(!ecs->entities.freeCount) {
+    Entity entity;
+    if(!reserveEntities(ecs, 1, &entity)) {
 #ifdef TARGET_PLAYDATE
         pd->system->error("No more free entities");
 #else
         abort();
 #endif
     }
-    
-    uint16_t id = newEntityFromPool(&ecs->entities);
-    uint8_t gen = generation(ecs->entities.data[id]);
-    ecs->entities.data[id] = createEntityData(gen);
-    return createHandle(id, gen);
+    return entity;
 }
 
 Entity newEntityWithArchetype(ECS *ecs, ComponentMask archetype) {
     Entity e = newEntity(ecs);
-    ecs->entities.data[entityIndex(e)].components = archetype;
+    addComponentsID(ecs, e, archetype, NULL);
     return e;
 }
 
 bool isEntityValid(const ECS *ecs, Entity entity) {
-    uint16_t gen = entityGen(entity);
-    return generation(ecs->entities.data[entityIndex(entity)]) == gen;
+    Index id = entityIndex(entity);
+#if ECS_MAX_ENTITIES < (1ull << ECS_INDEX_BITS)
+    if(id >= ECS_MAX_ENTITIES) return false;
+#endif
+    if(!bitTest(ecs->alive, id)) return false;
+    return generation(ecs->entities.data[id]) == entityGen(entity);
+}
+
+// Records that a component's row was handed out for writing, or removed.
+static void markWritten(ECS *ecs, uint8_t compID, Index id, bool present) {
+    ChangeLog *changes = ecs->compData[compID]->changes;
+    if(changes) {
+        changes->changed[id] = ecs->tick;
+        if(!present && !bitTest(changes->unextracted, id)) {
+            changes->removed[id] = generation(ecs->entities.data[id]);
+            bitSet(changes->unextracted, id);
+        }
+    }
+    if(ecs->hashing) markHashDirty(ecs, compID, id);
+    
+    Snapshot *snap = ecs->compData[compID]->snapshot;
+    if(!snap) return;
+    
+    uint8_t write = ecs->snapWrite;
+    if(present) {
+        bitSet(snap->present[write], id);
+    } else {
+        bitClear(snap->present[write], id);
+    }
+    bitSet(snap->stale[(write + 1) % 3], id);
+    bitSet(snap->stale[(write + 2) % 3], id);
 }
 
 void destroyEntity(ECS *ecs, Entity entity) {
     if(!isEntityValid(ecs, entity)) return;
-    uint16_t id = entityIndex(entity);
-    uint16_t gen = entityGen(entity);
+    Index id = entityIndex(entity);
+    Generation gen = entityGen(entity);
+    
+    ComponentMask components = ecs->entities.data[id].components;
+    leaveGroups(ecs, id, components);
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        if(!(components & (1 << i))) continue;
+        detachRow(ecs->compData[i], id);
+        markWritten(ecs, i, id, false);
+    }
+    if(ecs->journal) journalRecord(ecs, kJournalDestroy, id, 0);
+    
     ecs->entities.data[id] = createEntityData(gen+1);
+    bitClear(ecs->alive, id);
+    if(ecs->hashing) markHashDirty(ecs, kHashEntitySlot, id);
     returnEntityToPool(&ecs->entities, id);
 }
 
+void ecsClear(ECS *ecs) {
+    if(ecs->journal) journalRecord(ecs, kJournalClear, 0, 0);
+    for(uint32_t w = 0; w < ECS_BITMAP_WORDS; ++w) {
+        uint64_t alive = ecs->alive[w];
+        while(alive) {
+            Index id = w * 64 + __builtin_ctzll(alive);
+            alive &= alive - 1;
+            
+            EntityData data = ecs->entities.data[id];
+            for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+                if(data.components & (1 << i)) markWritten(ecs, i, id, false);
+            }
+            ecs->entities.data[id] = createEntityData(generation(data)+1);
+            if(ecs->hashing) markHashDirty(ecs, kHashEntitySlot, id);
+        }
+        ecs->alive[w] = 0;
+    }
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        ComponentData *comp = ecs->compData[i];
+        if(!comp) continue;
+        comp->count = 0;
+        comp->version += 1;
+        memset(comp->present, 0, sizeof(comp->present));
+        if(comp->bits) memset(comp->bits, 0, ECS_BITMAP_WORDS * comp->bitWidth * sizeof(uint64_t));
+        if(comp->buckets) memset(comp->buckets, 0, comp->bucketCount * sizeof(HashBucket));
+    }
+    for(uint8_t g = 0; g < ecs->groupCount; ++g) {
+        ecs->groups[g].size = 0;
+    }
+    resetEntityPool(&ecs->entities);
+}
+
 void *addComponentID(ECS *ecs, Entity entity, uint8_t compID) {
     ASSERT(compID < ECS_MAX_COMPS);
     ASSERT(isEntityValid(ecs, entity));
-    uint16_t id = entityIndex(entity);
-    ecs->entities.data[id].components |= (1 << compID);
-    return ecs->compData[compID]->data + compID * ecs->compData[compID]->size;
+    Index id = entityIndex(entity);
+    ComponentData *comp = worldComponent(ecs, compID);
+    if(!(ecs->entities.data[id].components & (1 << compID))) {
+        ecs->entities.data[id].components |= (1 << compID);
+        attachRow(comp, id);
+        joinGroups(ecs, id, 1 << compID);
+    }
+    markWritten(ecs, compID, id, true);
+    if(ecs->journal) journalRecord(ecs, kJournalAdd, id, compID);
+    return componentRow(comp, id);
+}
+
+// Gives the entity every component at once, so that it joins groups once, before handing out any
+// row: joining a group moves rows around.
+void addComponentsID(ECS *ecs, Entity entity, ComponentMask mask, void **components) {
+    ASSERT(isEntityValid(ecs, entity));
+    Index id = entityIndex(entity);
+    ComponentMask added = mask & ~ecs->entities.data[id].components;
+    ecs->entities.data[id].components |= mask;
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        if(added & (1 << i)) attachRow(worldComponent(ecs, i), id);
+    }
+    joinGroups(ecs, id, added);
+    
+    uint8_t count = 0;
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        if(!(mask & (1 << i))) continue;
+        markWritten(ecs, i, id, true);
+        if(ecs->journal) journalRecord(ecs, kJournalAdd, id, i);
+        if(components) components[count++] = componentRow(ecs->compData[i], id);
+    }
 }
 
 void *getComponentID(ECS *ecs, Entity entity, uint8_t compID) {
     ASSERT(compID < ECS_MAX_COMPS);
     ASSERT(isEntityValid(ecs, entity));
-    uint16_t id = entityIndex(entity);
+    Index id = entityIndex(entity);
+    if((ecs->entities.data[id].components & (1 << compID)) == 0) return NULL;
+    markWritten(ecs, compID, id, true);
+    return componentRow(ecs->compData[compID], id);
+}
+
+const void *readComponentID(const ECS *ecs, Entity entity, uint8_t compID) {
+    ASSERT(compID < ECS_MAX_COMPS);
+    ASSERT(isEntityValid(ecs, entity));
+    Index id = entityIndex(entity);
     if((ecs->entities.data[id].components & (1 << compID)) == 0) return NULL;
-    return ecs->compData[compID]->data + compID * ecs->compData[compID]->size;
+    return componentRow(ecs->compData[compID], id);
 }
 
 void removeComponentID(ECS *ecs, Entity entity, uint8_t compID) {
     ASSERT(compID < ECS_MAX_COMPS);
     ASSERT(isEntityValid(ecs, entity));
-    uint16_t id = entityIndex(entity);
+    Index id = entityIndex(entity);
+    if(!(ecs->entities.data[id].components & (1 << compID))) return;
+    leaveGroups(ecs, id, 1 << compID);
+    detachRow(ecs->compData[compID], id);
     ecs->entities.data[id].components &= ~(1 << compID);
+    markWritten(ecs, compID, id, false);
+    if(ecs->journal) journalRecord(ecs, kJournalRemove, id, compID);
 }
 
-// MARK: - Systems and matchers
+static uint8_t readBits(const ComponentData *comp, Index id) {
+    uint32_t bit = id * comp->bitWidth;
+    return (comp->bits[bit / 64] >> (bit % 64)) & ((1u << comp->bitWidth) - 1);
+}
 
-ECSID newSystem(ECS *ecs, ComponentMask mask, ECSIterator it, void *data) {
-    ASSERT(ecs->systemCount < ECS_MAX_SYSTEMS);
-    ASSERT(it != NULL);
+static void writeBits(ComponentData *comp, Index id, uint8_t value) {
+    uint32_t bit = id * comp->bitWidth;
+    uint64_t mask = (((uint64_t)1 << comp->bitWidth) - 1) << (bit % 64);
+    comp->bits[bit / 64] = (comp->bits[bit / 64] & ~mask) | (((uint64_t)value << (bit % 64)) & mask);
+}
+
+uint8_t ecsGetBits(const ECS *ecs, Entity entity, uint8_t compID) {
+    ASSERT(isEntityValid(ecs, entity));
+    const ComponentData *comp = ecs->compData[compID];
+    ASSERT(comp && comp->bits);
+    Index id = entityIndex(entity);
+    ASSERT(bitTest(comp->present, id));
+    return readBits(comp, id);
+}
+
+void ecsSetBits(ECS *ecs, Entity entity, uint8_t compID, uint8_t value) {
+    ASSERT(isEntityValid(ecs, entity));
+    ComponentData *comp = ecs->compData[compID];
+    ASSERT(comp && comp->bits);
+    Index id = entityIndex(entity);
+    ASSERT(bitTest(comp->present, id));
+    writeBits(comp, id, value);
+    markWritten(ecs, compID, id, true);
+}
+
+ComponentRef ecsComponentRef(ECS *ecs, Entity entity, uint8_t compID) {
+    ComponentRef ref = { .entity = entity, .id = compID, .version = 0, .data = NULL };
+    if(!isEntityValid(ecs, entity) || !ecs->compData[compID]) return ref;
+    ref.version = ecs->compData[compID]->version;
+    ref.data = getComponentID(ecs, entity, compID);
+    return ref;
+}
+
+void *ecsDeref(ECS *ecs, ComponentRef *ref) {
+    ComponentData *comp = ecs->compData[ref->id];
+    if(ref->data && comp->version == ref->version) {
+        markWritten(ecs, ref->id, entityIndex(ref->entity), true);
+        return ref->data;
+    }
+    *ref = ecsComponentRef(ecs, ref->entity, ref->id);
+    return ref->data;
+}
+
+// Creates an entity in `dst` with a copy of every component of `entity` in `src`.
+static Entity copyEntity(ECS *dst, const ECS *src, Entity entity) {
+    ASSERT(isEntityValid(src, entity));
+    Index srcID = entityIndex(entity);
+    ComponentMask components = src->entities.data[srcID].components;
     
-    ecs->systems[ecs->systemCount++] = (System) {
-        .id = ecs->nextSystemID++,
-        .mask = mask,
-        .func = it,
-        .userData = data
-    };
-    return 0;
+    Entity copy = newEntity(dst);
+    Index dstID = entityIndex(copy);
+    dst->entities.data[dstID].components = components;
+    
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        if(!(components & (1 << i))) continue;
+        const ComponentData *from = src->compData[i];
+        ComponentData *to = worldComponent(dst, i);
+        attachRow(to, dstID);
+        
+        // The registries may store the type differently, with rows of different sizes.
+        uint8_t *row = componentRow(to, dstID);
+        size_t size = from->size < to->size ? from->size : to->size;
+        if(size) memcpy(row, componentRow(from, srcID), size);
+        if(to->size > size) memset(row + size, 0, to->size - size);
+        
+        // Bit-packed values live outside of the rows, and are bytes in every other storage.
+        if(from->bits || to->bits) {
+            uint8_t value = 0;
+            if(from->bits) {
+                value = readBits(from, srcID);
+            } else if(from->size) {
+                value = *componentRow(from, srcID);
+            }
+            if(to->bits) {
+                writeBits(to, dstID, value);
+            } else if(to->size) {
+                *row = value;
+            }
+        }
+        markWritten(dst, i, dstID, true);
+        if(dst->journal) journalRecord(dst, kJournalAdd, dstID, i);
+    }
+    joinGroups(dst, dstID, components);
+    return copy;
 }
 
-static System *findSystem(ECS *ecs, ECSID id) {
-    for(uint8_t i = 0; i < ecs->systemCount; ++i) {
-        if(id == ecs->systems[i].id) return &ecs->systems[i];
+Entity ecsCloneEntity(ECS *ecs, Entity entity) {
+    return copyEntity(ecs, ecs, entity);
+}
+
+Entity ecsMoveEntity(ECS *src, ECS *dst, Entity entity) {
+    Entity moved = copyEntity(dst, src, entity);
+    destroyEntity(src, entity);
+    return moved;
+}
+
+// MARK: - Owning Groups
+
+static void putHashSlot(ComponentData *comp, Index id, uint32_t slot);
+
+static void setSlot(ComponentData *comp, Index id, uint32_t slot) {
+    if(comp->slotOf) {
+        comp->slotOf[id] = slot;
+    } else {
+        putHashSlot(comp, id, slot);
     }
-    return NULL;
 }
 
-void destroySystem(ECS *ecs, ECSID id) {
-    ASSERT(ecs->systemCount > 0);
+static uint32_t rowSlot(const ComponentData *comp, Index id) {
+    return comp->slotOf ? comp->slotOf[id] : findHashSlot(comp, id);
+}
+
+static void putHashSlot(ComponentData *comp, Index id, uint32_t slot) {
+    uint32_t bucket = hashBucket(comp, id);
+    while(comp->buckets[bucket].key && comp->buckets[bucket].key != (uint32_t)id + 1) {
+        bucket = (bucket + 1) & (comp->bucketCount - 1);
+    }
+    comp->buckets[bucket] = (HashBucket){ .key = (uint32_t)id + 1, .slot = slot };
+}
+
+// Removes an entity from a hash map's buckets, moving back the entries that probed past it.
+static void eraseHashSlot(ComponentData *comp, Index id) {
+    uint32_t mask = comp->bucketCount - 1;
+    uint32_t hole = hashBucket(comp, id);
+    while(comp->buckets[hole].key != (uint32_t)id + 1) hole = (hole + 1) & mask;
     
-    System *sys = findSystem(ecs, id);
-    if(!sys) return;
+    for(uint32_t bucket = (hole + 1) & mask; comp->buckets[bucket].key; bucket = (bucket + 1) & mask) {
+        uint32_t home = hashBucket(comp, comp->buckets[bucket].key - 1);
+        if(((bucket - home) & mask) < ((bucket - hole) & mask)) continue;
+        comp->buckets[hole] = comp->buckets[bucket];
+        hole = bucket;
+    }
+    comp->buckets[hole].key = 0;
+}
+
+// Keeps a hash map at most half full.
+static void growHashBuckets(ComponentData *comp) {
+    if(2 * (comp->count + 1) <= comp->bucketCount) return;
+    HashBucket *old = comp->buckets;
+    uint32_t oldCount = comp->bucketCount;
     
-    System *begin = sys + 1;
-    System *end = ecs->systems+ecs->systemCount;
-    memmove(begin, sys, sizeof(System) * (end - begin));
-    ecs->systemCount -= 1;
+    comp->bucketCount *= 2;
+    comp->buckets = calloc(comp->bucketCount, sizeof(HashBucket));
+    for(uint32_t i = 0; i < oldCount; ++i) {
+        if(old[i].key) putHashSlot(comp, old[i].key - 1, old[i].slot);
+    }
+    free(old);
 }
 
-void ecsTick(ECS *ecs) {
-    for(uint8_t i = 0; i < ecs->systemCount; ++i) {
-        matchEntities(ecs,
-                      ecs->systems[i].mask,
-                      ecs->systems[i].func,
-                      ecs->systems[i].userData);
+// Swaps two rows of a packed table, along with the entities they belong to.
+static void swapRows(ComponentData *comp, Index a, Index b) {
+    if(a == b) return;
+    comp->version += 1;
+    uint8_t *rowA = comp->data + a * comp->size;
+    uint8_t *rowB = comp->data + b * comp->size;
+    for(size_t i = 0; i < comp->size; ++i) {
+        uint8_t byte = rowA[i];
+        rowA[i] = rowB[i];
+        rowB[i] = byte;
+    }
+    
+    Index entityA = comp->entityAt[a];
+    Index entityB = comp->entityAt[b];
+    comp->entityAt[a] = entityB;
+    comp->entityAt[b] = entityA;
+    setSlot(comp, entityA, b);
+    setSlot(comp, entityB, a);
+}
+
+// Gives an entity a row at the end of a packed table, growing sparse sets and hash maps as needed.
+static void attachRow(ComponentData *comp, Index id) {
+    bitSet(comp->present, id);
+    // Bit-packed values would otherwise keep whatever the previous entity at this index left.
+    if(comp->bits) writeBits(comp, id, 0);
+    if(!comp->slotOf && !comp->buckets) return;
+    if(comp->count == comp->capacity) {
+        ASSERT(comp->capacity < ECS_MAX_ENTITIES);
+        comp->capacity = comp->capacity ? 2 * comp->capacity : 16;
+        if(comp->capacity > ECS_MAX_ENTITIES) comp->capacity = ECS_MAX_ENTITIES;
+        comp->data = realloc(comp->data, comp->capacity * comp->size);
+        comp->version += 1;
+        comp->entityAt = realloc(comp->entityAt, comp->capacity * sizeof(Index));
     }
+    if(comp->buckets) growHashBuckets(comp);
+    setSlot(comp, id, comp->count);
+    comp->entityAt[comp->count++] = id;
 }
 
+// Fills the hole left by an entity's row with the last row of a packed table.
+static void detachRow(ComponentData *comp, Index id) {
+    bitClear(comp->present, id);
+    comp->version += 1;
+    if(!comp->slotOf && !comp->buckets) return;
+    swapRows(comp, rowSlot(comp, id), comp->count - 1);
+    comp->count -= 1;
+    if(comp->buckets) eraseHashSlot(comp, id);
+}
 
-void matchEntities(ECS *ecs, ComponentMask mask, ECSIterator it, void *userData) {
+static bool inGroup(const ECS *ecs, const Group *group, Index id) {
+    if((ecs->entities.data[id].components & group->owned) != group->owned) return false;
+    return ecs->compData[__builtin_ctz(group->owned)]->slotOf[id] < group->size;
+}
+
+static void joinGroup(ECS *ecs, Group *group, Index id) {
+    for(uint8_t i = 0; i < group->compCount; ++i) {
+        ComponentData *comp = ecs->compData[group->comps[i]];
+        swapRows(comp, rowSlot(comp, id), group->size);
+    }
+    group->size += 1;
+}
+
+// Moves an entity to the end of the groups it now has every component of. Each component is
+// owned by at most one group, so only the groups of the components that changed are looked at.
+static void joinGroups(ECS *ecs, Index id, ComponentMask added) {
+    ComponentMask owned = added & ecs->ownedComponents;
+    while(owned) {
+        Group *group = &ecs->groups[ecs->compData[__builtin_ctz(owned)]->group];
+        owned &= ~group->owned;
+        if((ecs->entities.data[id].components & group->owned) != group->owned) continue;
+        if(!inGroup(ecs, group, id)) joinGroup(ecs, group, id);
+    }
+}
+
+// Moves an entity out of the groups it's about to lose a component of, by swapping it with the
+// last member of each group.
+static void leaveGroups(ECS *ecs, Index id, ComponentMask removed) {
+    ComponentMask owned = removed & ecs->ownedComponents;
+    while(owned) {
+        Group *group = &ecs->groups[ecs->compData[__builtin_ctz(owned)]->group];
+        owned &= ~group->owned;
+        if(!inGroup(ecs, group, id)) continue;
+        
+        group->size -= 1;
+        for(uint8_t i = 0; i < group->compCount; ++i) {
+            ComponentData *comp = ecs->compData[group->comps[i]];
+            swapRows(comp, rowSlot(comp, id), group->size);
+        }
+    }
+}
+
+// Switches a table from rows indexed by entity to packed rows.
+static void packComponent(ECS *ecs, ComponentData *comp, uint8_t compID) {
+    size_t tableSize = ECS_MAX_ENTITIES * comp->size;
+    uint8_t *rows = malloc(tableSize);
+    memcpy(rows, comp->data, tableSize);
+    
+    comp->slotOf = malloc(ECS_MAX_ENTITIES * sizeof(Index));
+    comp->entityAt = malloc(ECS_MAX_ENTITIES * sizeof(Index));
+    comp->count = 0;
+    comp->capacity = ECS_MAX_ENTITIES;
+    comp->version += 1;
+    for(uint32_t id = 0; id < ECS_MAX_ENTITIES; ++id) {
+        if(!bitTest(ecs->alive, id)) continue;
+        if(!(ecs->entities.data[id].components & (1 << compID))) continue;
+        attachRow(comp, id);
+        memcpy(componentRow(comp, id), rows + id * comp->size, comp->size);
+    }
+    free(rows);
+}
+
+ECSID ecsNewGroup(ECS *ecs, ComponentMask owned) {
+    ASSERT(owned != 0);
+    ASSERT(ecs->groupCount < ECS_MAX_COMPS);
+    ECSID groupID = ecs->groupCount++;
+    Group *group = &ecs->groups[groupID];
+    group->owned = owned;
+    group->compCount = 0;
+    group->size = 0;
+    ecs->ownedComponents |= owned;
+    
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        if(!(owned & (1 << i))) continue;
+        ComponentData *comp = worldComponent(ecs, i);
+        ASSERT(comp->group == ECS_MAX_COMPS);
+        ASSERT(comp->storage == kStorageTable || comp->storage == kStorageSparse);
+        ASSERT(!comp->snapshot);
+        comp->group = groupID;
+        group->comps[group->compCount++] = i;
+        if(comp->storage == kStorageTable) packComponent(ecs, comp, i);
+    }
     
-    for(uint16_t id = 0; id < ECS_MAX_ENTITIES; ++id) {
-        EntityData data = ecs->entities.data[id];
-        if(flags(data) & kEntityUnused) continue;
-        if((data.components & mask) != mask) continue;
-        it(ecs, createHandle(id, generation(data)), userData);
+    for(uint32_t id = 0; id < ECS_MAX_ENTITIES; ++id) {
+        if(!bitTest(ecs->alive, id)) continue;
+        if((ecs->entities.data[id].components & owned) != owned) continue;
+        joinGroup(ecs, group, id);
+    }
+    return groupID;
+}
+
+uint32_t ecsGroupSize(const ECS *ecs, ECSID group) {
+    ASSERT(group < ecs->groupCount);
+    return ecs->groups[group].size;
+}
+
+Entity ecsGroupEntity(const ECS *ecs, ECSID group, uint32_t index) {
+    ASSERT(index < ecsGroupSize(ecs, group));
+    Index id = ecs->compData[__builtin_ctz(ecs->groups[group].owned)]->entityAt[index];
+    return createHandle(id, generation(ecs->entities.data[id]));
+}
+
+void *ecsGroupComponent(ECS *ecs, ECSID group, uint8_t compID) {
+    ASSERT(group < ecs->groupCount);
+    ASSERT(ecs->groups[group].owned & (1 << compID));
+    ComponentData *comp = ecs->compData[compID];
+    for(uint32_t i = 0; i < ecs->groups[group].size; ++i) {
+        markWritten(ecs, compID, comp->entityAt[i], true);
     }
+    return comp->data;
+}
+
+// MARK: - Snapshots
+
+void ecsBufferComponent(ECS *ecs, uint8_t compID) {
+    ComponentData *comp = worldComponent(ecs, compID);
+    if(comp->snapshot) return;
+    ASSERT(comp->storage == kStorageTable || comp->storage == kStorageTag);
+    // Snapshots are indexed by entity, which packed rows aren't.
+    ASSERT(comp->group == ECS_MAX_COMPS && !comp->slotOf);
+    
+    Snapshot *snap = calloc(1, sizeof(Snapshot));
+    size_t tableSize = ECS_MAX_ENTITIES * comp->size;
+    for(uint8_t i = 0; i < 3; ++i) {
+        snap->data[i] = i == ecs->snapWrite ? comp->table : malloc(tableSize);
+        if(i != ecs->snapWrite) memcpy(snap->data[i], comp->table, tableSize);
+    }
+    
+    for(uint32_t id = 0; id < ECS_MAX_ENTITIES; ++id) {
+        if(!(ecs->entities.data[id].components & (1 << compID))) continue;
+        for(uint8_t i = 0; i < 3; ++i) {
+            bitSet(snap->present[i], id);
+        }
+    }
+    
+    comp->snapshot = snap;
+    ecs->hasSnapshots = true;
+}
+
+// Brings a copy up to date with the one that was just published, row by row.
+static void catchUpSnapshot(ComponentData *comp, uint8_t from, uint8_t to) {
+    Snapshot *snap = comp->snapshot;
+    for(uint32_t w = 0; w < ECS_BITMAP_WORDS; ++w) {
+        uint64_t stale = snap->stale[to][w];
+        if(!stale) continue;
+        
+        snap->present[to][w] = (snap->present[to][w] & ~stale) | (snap->present[from][w] & stale);
+        while(stale) {
+            Index id = w * 64 + __builtin_ctzll(stale);
+            stale &= stale - 1;
+            memcpy(snap->data[to] + id * comp->size, snap->data[from] + id * comp->size, comp->size);
+        }
+        snap->stale[to][w] = 0;
+    }
+}
+
+static void publishSnapshot(ECS *ecs) {
+    uint8_t published = ecs->snapWrite;
+    uint8_t write = atomicSwap(&ecs->snapMiddle, published | kSnapshotFresh) & kSnapshotIndex;
+    
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        ComponentData *comp = ecs->compData[i];
+        if(!comp || !comp->snapshot) continue;
+        catchUpSnapshot(comp, published, write);
+        comp->data = comp->snapshot->data[write];
+        comp->version += 1;
+    }
+    ecs->snapWrite = write;
+}
+
+bool ecsAcquireSnapshot(ECS *ecs) {
+    if(!(atomicLoad(&ecs->snapMiddle) & kSnapshotFresh)) return false;
+    ecs->snapRead = atomicSwap(&ecs->snapMiddle, ecs->snapRead) & kSnapshotIndex;
+    return true;
+}
+
+const void *getSnapshotComponentID(const ECS *ecs, Index index, uint8_t compID) {
+    ASSERT(compID < ECS_MAX_COMPS);
+    const ComponentData *comp = ecs->compData[compID];
+    ASSERT(comp != NULL && comp->snapshot != NULL);
+    
+    if(!bitTest(comp->snapshot->present[ecs->snapRead], index)) return NULL;
+    return comp->snapshot->data[ecs->snapRead] + index * comp->size;
+}
+
+void matchSnapshot(const ECS *ecs, ComponentMask mask, ECSSnapshotIterator it, void *userData) {
+    uint8_t read = ecs->snapRead;
+    for(uint32_t w = 0; w < ECS_BITMAP_WORDS; ++w) {
+        uint64_t match = ~(uint64_t)0;
+        for(uint8_t i = 0; i < ECS_MAX_COMPS && match; ++i) {
+            if(!(mask & (1 << i))) continue;
+            ASSERT(ecs->compData[i] != NULL && ecs->compData[i]->snapshot != NULL);
+            match &= ecs->compData[i]->snapshot->present[read][w];
+        }
+        
+        while(match) {
+            uint32_t id = w * 64 + __builtin_ctzll(match);
+            match &= match - 1;
+            if(id >= ECS_MAX_ENTITIES) break;
+            it(ecs, id, userData);
+        }
+    }
+}
+
+// MARK: - Extraction
+
+ECSPacket *newPacket(void) {
+    ECSPacket *packet = malloc(sizeof(*packet));
+    packet->count = 0;
+    packet->size = 0;
+    packet->capacity = 0;
+    packet->data = NULL;
+    return packet;
+}
+
+void destroyPacket(ECSPacket *packet) {
+    free(packet->data);
+    free(packet);
+}
+
+static void writePacket(ECSPacket *packet, PacketHeader header, const void *data) {
+    size_t size = sizeof(header) + (data ? header.size : 0);
+    if(packet->size + size > packet->capacity) {
+        while(packet->size + size > packet->capacity) {
+            packet->capacity = packet->capacity ? packet->capacity * 2 : 1024;
+        }
+        packet->data = realloc(packet->data, packet->capacity);
+    }
+    
+    memcpy(packet->data + packet->size, &header, sizeof(header));
+    if(data) memcpy(packet->data + packet->size + sizeof(header), data, header.size);
+    packet->size += size;
+    packet->count += 1;
+}
+
+size_t ecsExtract(ECS *ecs, ComponentMask mask, ECSPacket *packet) {
+    packet->count = 0;
+    packet->size = 0;
+    trackChanges(ecs);
+    
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        if(!(mask & (1 << i)) || !ecs->compData[i]) continue;
+        ComponentData *comp = ecs->compData[i];
+        
+        ChangeLog *changes = comp->changes;
+        for(uint32_t id = 0; id < ECS_MAX_ENTITIES; ++id) {
+            if(changes->changed[id] <= ecs->lastExtract) continue;
+            EntityData data = ecs->entities.data[id];
+            bool present = (data.components & (1 << i)) != 0;
+            
+            // Removals name the entity as it was then: it may have been destroyed since, and its
+            // index reused.
+            if(bitTest(changes->unextracted, id)) {
+                bitClear(changes->unextracted, id);
+                if(!present || changes->removed[id] != generation(data)) {
+                    PacketHeader header = {
+                        .entity = createHandle(id, changes->removed[id]),
+                        .size = comp->size,
+                        .id = i,
+                        .present = false,
+                    };
+                    writePacket(packet, header, NULL);
+                }
+            }
+            if(!present) continue;
+            PacketHeader header = {
+                .entity = createHandle(id, generation(data)),
+                .size = comp->size,
+                .id = i,
+                .present = true,
+            };
+            writePacket(packet, header, componentRow(comp, id));
+        }
+    }
+    
+    // Writes made after this point must be newer than the extraction, even within the same tick.
+    ecs->lastExtract = ecs->tick++;
+    return packet->count;
+}
+
+bool readPacket(const ECSPacket *packet, size_t *cursor, ECSPacketRecord *record) {
+    if(*cursor >= packet->size) return false;
+    
+    PacketHeader header;
+    memcpy(&header, packet->data + *cursor, sizeof(header));
+    *cursor += sizeof(header);
+    
+    record->entity = header.entity;
+    record->id = header.id;
+    record->size = header.size;
+    record->data = header.present ? packet->data + *cursor : NULL;
+    if(header.present) *cursor += header.size;
+    return true;
+}
+
+// MARK: - Replication
+
+enum {
+    kDiffEnd        = 0,
+    kDiffCreate     = 1,
+    kDiffDestroy    = 2,
+    kDiffAdd        = 3,
+    kDiffUpdate     = 4,
+    kDiffRemove     = 5,
+};
+
+// What the receiving registry is known to hold, as of the last diff.
+typedef struct {
+    uint8_t         *rows;
+    uint64_t        present[ECS_BITMAP_WORDS];
+} Baseline;
+
+struct ECSReplicator {
+    ComponentMask   mask;
+    uint32_t        lastTick;
+    uint64_t        alive[ECS_BITMAP_WORDS];
+    Generation      generations[ECS_MAX_ENTITIES];
+    Baseline        *components[ECS_MAX_COMPS];
+    ByteBuffer      diff;
+};
+
+ECSReplicator *newReplicator(ComponentMask mask) {
+    ECSReplicator *rep = calloc(1, sizeof(*rep));
+    rep->mask = mask;
+    return rep;
+}
+
+void destroyReplicator(ECSReplicator *rep) {
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        if(!rep->components[i]) continue;
+        free(rep->components[i]->rows);
+        free(rep->components[i]);
+    }
+    free(rep->diff.data);
+    free(rep);
+}
+
+// Writes `row` XOR `base` as alternating runs of unchanged bytes and changed bytes, and brings
+// `base` up to date.
+static void writeDiffRow(ECSReplicator *rep, uint8_t *base, const uint8_t *row, size_t size) {
+    size_t i = 0;
+    while(i < size) {
+        size_t same = i;
+        while(same < size && base[same] == row[same]) ++same;
+        size_t changed = same;
+        while(changed < size && base[changed] != row[changed]) ++changed;
+        
+        writeVarint(&rep->diff, same - i);
+        writeVarint(&rep->diff, changed - same);
+        for(size_t j = same; j < changed; ++j) {
+            writeByte(&rep->diff, base[j] ^ row[j]);
+            base[j] = row[j];
+        }
+        i = changed;
+    }
+}
+
+static Baseline *replicatorBaseline(ECSReplicator *rep, uint8_t compID) {
+    if(!rep->components[compID]) {
+        rep->components[compID] = calloc(1, sizeof(Baseline));
+        rep->components[compID]->rows = calloc(ECS_MAX_ENTITIES, types[compID].size);
+    }
+    return rep->components[compID];
+}
+
+const void *ecsWriteDiff(ECS *ecs, ECSReplicator *rep, size_t *size) {
+    rep->diff.size = 0;
+    trackChanges(ecs);
+    
+    // Entities first, so that the receiver has them before their components.
+    for(uint32_t w = 0; w < ECS_BITMAP_WORDS; ++w) {
+        uint64_t changed = ecs->alive[w] | rep->alive[w];
+        while(changed) {
+            Index id = w * 64 + __builtin_ctzll(changed);
+            changed &= changed - 1;
+            
+            bool alive = bitTest(ecs->alive, id);
+            Generation gen = generation(ecs->entities.data[id]);
+            if(alive == bitTest(rep->alive, id) && (!alive || gen == rep->generations[id])) continue;
+            
+            // Whatever the receiver had at this index is gone.
+            for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+                if(rep->components[i]) bitClear(rep->components[i]->present, id);
+            }
+            
+            writeByte(&rep->diff, alive ? kDiffCreate : kDiffDestroy);
+            writeVarint(&rep->diff, id);
+            if(alive) {
+                writeVarint(&rep->diff, gen);
+                bitSet(rep->alive, id);
+                rep->generations[id] = gen;
+            } else {
+                bitClear(rep->alive, id);
+            }
+        }
+    }
+    
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        if(!(rep->mask & (1 << i)) || !ecs->compData[i]) continue;
+        ComponentData *comp = ecs->compData[i];
+        Baseline *base = replicatorBaseline(rep, i);
+        
+        for(uint32_t id = 0; id < ECS_MAX_ENTITIES; ++id) {
+            if(comp->changes->changed[id] <= rep->lastTick) continue;
+            
+            bool present = (ecs->entities.data[id].components & (1 << i)) != 0;
+            bool known = bitTest(base->present, id);
+            if(!present && !known) continue;
+            
+            uint8_t *baseRow = base->rows + id * comp->size;
+            if(!present) {
+                writeByte(&rep->diff, kDiffRemove);
+                writeVarint(&rep->diff, id);
+                writeByte(&rep->diff, i);
+                bitClear(base->present, id);
+                continue;
+            }
+            
+            const uint8_t *row = componentRow(comp, id);
+            if(known && !memcmp(baseRow, row, comp->size)) continue;
+            
+            writeByte(&rep->diff, known ? kDiffUpdate : kDiffAdd);
+            writeVarint(&rep->diff, id);
+            writeByte(&rep->diff, i);
+            if(!known) memset(baseRow, 0, comp->size);
+            writeDiffRow(rep, baseRow, row, comp->size);
+            bitSet(base->present, id);
+        }
+    }
+    
+    writeByte(&rep->diff, kDiffEnd);
+    rep->lastTick = ecs->tick++;
+    *size = rep->diff.size;
+    return rep->diff.data;
+}
+
+// Takes a specific index out of the pool, for registries that mirror another one.
+static void claimEntityIndex(EntityPool *pool, Index id) {
+    if(id >= pool->nextUnused) {
+        for(uint32_t i = pool->nextUnused; i < id; ++i) {
+            returnEntityToPool(pool, i);
+        }
+        pool->nextUnused = id + 1;
+        return;
+    }
+    
+    for(uint32_t i = 0; i < pool->freeCount; ++i) {
+        if(pool->freeList[i] != id) continue;
+        pool->freeList[i] = pool->freeList[--pool->freeCount];
+        return;
+    }
+    ASSERT(false);
+}
+
+// Reads a varint written by `writeVarint` from untrusted input, failing rather than reading past
+// `end`.
+static bool readVarintBounded(const uint8_t **cursor, const uint8_t *end, uint32_t *value) {
+    *value = 0;
+    for(unsigned shift = 0; shift < 35 && *cursor < end; shift += 7) {
+        uint8_t byte = *(*cursor)++;
+        *value |= (uint32_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool ecsApplyDiff(ECS *ecs, const void *diff, size_t size) {
+    const uint8_t *cursor = diff;
+    const uint8_t *end = cursor + size;
+    
+    // Diffs come from the network: every field is checked before it is used.
+    while(cursor < end) {
+        uint8_t kind = *cursor++;
+        if(kind == kDiffEnd) return true;
+        if(kind > kDiffRemove) return false;
+        uint32_t id;
+        if(!readVarintBounded(&cursor, end, &id) || id >= ECS_MAX_ENTITIES) return false;
+        Entity current = createHandle(id, generation(ecs->entities.data[id]));
+        
+        if(kind == kDiffCreate || kind == kDiffDestroy) {
+            uint32_t gen = 0;
+            if(kind == kDiffCreate && !readVarintBounded(&cursor, end, &gen)) return false;
+            destroyEntity(ecs, current);
+            if(kind == kDiffDestroy) continue;
+            
+            claimEntityIndex(&ecs->entities, id);
+            ecs->entities.data[id] = createEntityData(gen);
+            bitSet(ecs->alive, id);
+            if(ecs->hashing) markHashDirty(ecs, kHashEntitySlot, id);
+            if(ecs->journal) journalRecord(ecs, kJournalCreate, id, generation(ecs->entities.data[id]));
+            continue;
+        }
+        
+        if(cursor == end || !isEntityValid(ecs, current)) return false;
+        uint8_t compID = *cursor++;
+        if(compID >= atomicLoad(&typeCount)) return false;
+        if(kind == kDiffRemove) {
+            removeComponentID(ecs, current, compID);
+            continue;
+        }
+        
+        if(kind == kDiffUpdate && !(ecs->entities.data[id].components & (1 << compID))) return false;
+        uint8_t *row = kind == kDiffAdd
+            ? addComponentID(ecs, current, compID)
+            : getComponentID(ecs, current, compID);
+        size_t compSize = ecs->compData[compID]->size;
+        if(kind == kDiffAdd && compSize) memset(row, 0, compSize);
+        
+        for(size_t i = 0; i < compSize;) {
+            uint32_t same, changed;
+            if(!readVarintBounded(&cursor, end, &same) || same > compSize - i) return false;
+            i += same;
+            if(!readVarintBounded(&cursor, end, &changed) || changed > compSize - i) return false;
+            if(changed > (size_t)(end - cursor)) return false;
+            for(uint32_t j = 0; j < changed; ++j) {
+                row[i++] ^= *cursor++;
+            }
+        }
+    }
+    return false;
+}
+
+// MARK: - World Hashing
+
+static uint64_t mixHash(uint64_t hash) {
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+// Hash of one row, or 0 if the entity doesn't have it. The world hash is the sum of every row's
+// hash, so that rows can be added and taken out of it in any order.
+static uint64_t hashRow(const ECS *ecs, uint8_t slot, Index id) {
+    EntityData data = ecs->entities.data[id];
+    if(!bitTest(ecs->alive, id)) return 0;
+    
+    uint64_t hash = 0xcbf29ce484222325ull ^ ((uint64_t)slot << 48) ^ id;
+    if(slot == kHashEntitySlot) return mixHash(hash ^ ((uint64_t)generation(data) << 32));
+    if(!(data.components & (1 << slot))) return 0;
+    
+    const ComponentData *comp = ecs->compData[slot];
+    const uint8_t *row = componentRow(comp, id);
+    for(size_t i = 0; i < comp->size; ++i) {
+        hash = (hash ^ row[i]) * 0x100000001b3ull;
+    }
+    return mixHash(hash);
+}
+
+static void markHashDirty(ECS *ecs, uint8_t slot, Index id) {
+    HashSlot *hashSlot = ecs->hashSlots[slot];
+    if(!hashSlot) return;
+    if(bitTestAndSet(hashSlot->dirty, id)) return;
+    uint32_t index = atomicAdd(&ecs->dirtyCount, 1);
+    ecs->dirtyRows[index] = (DirtyRow){ .slot = slot, .id = id };
+}
+
+static void enableHashSlot(ECS *ecs, uint8_t slot) {
+    HashSlot *hashSlot = calloc(1, sizeof(HashSlot));
+    for(uint32_t id = 0; id < ECS_MAX_ENTITIES; ++id) {
+        hashSlot->rows[id] = hashRow(ecs, slot, id);
+        ecs->hash += hashSlot->rows[id];
+    }
+    ecs->hashSlots[slot] = hashSlot;
+}
+
+void ecsEnableHashing(ECS *ecs) {
+    if(ecs->hashing) return;
+    ecs->dirtyRows = malloc((ECS_MAX_COMPS + 1) * ECS_MAX_ENTITIES * sizeof(DirtyRow));
+    ecs->dirtyCount = 0;
+    ecs->hash = 0;
+    
+    enableHashSlot(ecs, kHashEntitySlot);
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        if(ecs->compData[i]) enableHashSlot(ecs, i);
+    }
+    ecs->hashing = true;
+}
+
+uint64_t ecsWorldHash(ECS *ecs) {
+    ASSERT(ecs->hashing);
+    uint32_t count = ecs->dirtyCount;
+    for(uint32_t i = 0; i < count; ++i) {
+        DirtyRow dirty = ecs->dirtyRows[i];
+        HashSlot *hashSlot = ecs->hashSlots[dirty.slot];
+        
+        uint64_t hash = hashRow(ecs, dirty.slot, dirty.id);
+        ecs->hash += hash - hashSlot->rows[dirty.id];
+        hashSlot->rows[dirty.id] = hash;
+        bitClear(hashSlot->dirty, dirty.id);
+    }
+    ecs->dirtyCount = 0;
+    return ecs->hash;
+}
+
+// MARK: - Journal
+
+struct ECSJournal {
+    ByteBuffer      data;
+    ComponentMask   types;
+    uint32_t        lastTick;
+};
+
+ECSJournal *newJournal(void) {
+    return calloc(1, sizeof(ECSJournal));
+}
+
+void destroyJournal(ECSJournal *journal) {
+    free(journal->data.data);
+    free(journal);
+}
+
+const void *journalData(const ECSJournal *journal, size_t *size) {
+    *size = journal->data.size;
+    return journal->data.data;
+}
+
+// Component types are described in the journal the first time they appear, along with how the
+// registry stores them, so that it can be replayed in a process that registered them in a
+// different order.
+static void journalType(ECS *ecs, uint8_t compID) {
+    ECSJournal *journal = ecs->journal;
+    if(journal->types & (1 << compID)) return;
+    journal->types |= (1 << compID);
+    
+    const ComponentData *comp = ecs->compData[compID];
+    size_t length = strlen(types[compID].id) + 1;
+    writeByte(&journal->data, kJournalType);
+    writeVarint(&journal->data, compID);
+    writeVarint(&journal->data, types[compID].size);
+    writeByte(&journal->data, comp->storage);
+    writeByte(&journal->data, comp->bitWidth);
+    memcpy(appendBytes(&journal->data, length), types[compID].id, length);
+}
+
+static void journalRecord(ECS *ecs, uint8_t kind, uint32_t id, uint32_t arg) {
+    ECSJournal *journal = ecs->journal;
+    bool component = kind == kJournalAdd || kind == kJournalRemove || kind == kJournalWrite;
+    if(component) journalType(ecs, arg);
+    
+    writeByte(&journal->data, kind);
+    if(kind == kJournalClear || kind == kJournalTick) return;
+    writeVarint(&journal->data, id);
+    if(component) {
+        writeByte(&journal->data, arg);
+    } else if(kind != kJournalDestroy && kind != kJournalRunTick && kind != kJournalDestroySystem) {
+        writeVarint(&journal->data, arg);
+    }
+}
+
+// Records the bytes of every component written since the last call.
+static void journalWrites(ECS *ecs) {
+    ECSJournal *journal = ecs->journal;
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        const ComponentData *comp = ecs->compData[i];
+        if(!comp || !comp->size) continue;
+        
+        for(uint32_t id = 0; id < ECS_MAX_ENTITIES; ++id) {
+            if(comp->changes->changed[id] <= journal->lastTick) continue;
+            if(!(ecs->entities.data[id].components & (1 << i))) continue;
+            journalRecord(ecs, kJournalWrite, id, i);
+            memcpy(appendBytes(&journal->data, comp->size), componentRow(comp, id), comp->size);
+        }
+    }
+    journal->lastTick = ecs->tick;
+}
+
+
+void ecsSetJournal(ECS *ecs, ECSJournal *journal) {
+    if(ecs->journal) journalWrites(ecs);
+    ecs->journal = journal;
+    if(!journal) return;
+    trackChanges(ecs);
+    
+    // Start with the registry's current state, so that the journal replays on its own.
+    updateSystems(ecs);
+    for(uint8_t i = 0; i < ecs->systemOrderCount; ++i) {
+        ECSSystem handle = ecs->systemOrder[i];
+        const System *sys = findSystem(ecs, handle);
+        journalRecord(ecs, kJournalSystem, handle, sys->mask);
+        journalRecord(ecs, kJournalPhase, handle, sys->phases);
+        journalRecord(ecs, kJournalEnable, handle, sys->enabled);
+    }
+    for(uint32_t w = 0; w < ECS_BITMAP_WORDS; ++w) {
+        uint64_t alive = ecs->alive[w];
+        while(alive) {
+            Index id = w * 64 + __builtin_ctzll(alive);
+            alive &= alive - 1;
+            
+            EntityData data = ecs->entities.data[id];
+            journalRecord(ecs, kJournalCreate, id, generation(data));
+            for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+                if(!(data.components & (1 << i))) continue;
+                journalRecord(ecs, kJournalAdd, id, i);
+                size_t size = ecs->compData[i]->size;
+                if(!size) continue;
+                journalRecord(ecs, kJournalWrite, id, i);
+                memcpy(appendBytes(&journal->data, size), componentRow(ecs->compData[i], id), size);
+            }
+        }
+    }
+    journal->lastTick = ecs->tick++;
+}
+
+// Returns the replayed entity for a recorded index. Entities created by systems aren't journaled,
+// but replaying the systems creates them again, at the index they were recorded with.
+static Entity replayedEntity(const ECS *ecs, const Entity *entities, const uint64_t *mapped,
+                             Index id) {
+    if(bitTest(mapped, id) && isEntityValid(ecs, entities[id])) return entities[id];
+    return createHandle(id, generation(ecs->entities.data[id]));
+}
+
+void ecsReplay(ECS *ecs, const void *data, size_t size, ECSSystemResolver resolve, void *userData) {
+    const uint8_t *cursor = data;
+    const uint8_t *end = cursor + size;
+    Entity *entities = malloc(ECS_MAX_ENTITIES * sizeof(Entity));
+    uint64_t mapped[ECS_BITMAP_WORDS] = {0};
+    ECSID typeMap[ECS_MAX_COMPS];
+    // The systems created by `resolve`, by the index of the handle they were recorded with.
+    ECSSystem systems[ECS_MAX_SYSTEMS];
+    bool resolved[ECS_MAX_SYSTEMS] = {0};
+    
+    while(cursor < end) {
+        uint8_t kind = *cursor++;
+        switch(kind) {
+        case kJournalType: {
+            uint32_t id = readVarint(&cursor);
+            uint32_t compSize = readVarint(&cursor);
+            ECSStorage storage = *cursor++;
+            uint8_t bitWidth = *cursor++;
+            if(storage == kStorageBits) compSize = bitWidth;
+            typeMap[id] = ecsDeclareComponentStorage(ecs, (const char *)cursor, compSize, storage);
+            cursor += strlen((const char *)cursor) + 1;
+            break;
+        }
+        
+        case kJournalCreate: {
+            Index id = readVarint(&cursor);
+            entities[id] = newEntity(ecs);
+            bitSet(mapped, id);
+            readVarint(&cursor);
+            break;
+        }
+            
+        case kJournalDestroy: {
+            Index id = readVarint(&cursor);
+            destroyEntity(ecs, replayedEntity(ecs, entities, mapped, id));
+            bitClear(mapped, id);
+            break;
+        }
+            
+        case kJournalClear:
+            ecsClear(ecs);
+            memset(mapped, 0, sizeof(mapped));
+            break;
+            
+        case kJournalAdd:
+        case kJournalRemove:
+        case kJournalWrite: {
+            Entity entity = replayedEntity(ecs, entities, mapped, readVarint(&cursor));
+            ECSID id = typeMap[*cursor++];
+            if(kind == kJournalRemove) {
+                removeComponentID(ecs, entity, id);
+            } else if(kind == kJournalAdd) {
+                addComponentID(ecs, entity, id);
+            } else {
+                size_t compSize = ecs->compData[id]->size;
+                memcpy(getComponentID(ecs, entity, id), cursor, compSize);
+                cursor += compSize;
+            }
+            break;
+        }
+        
+        case kJournalSystem: {
+            ECSSystem handle = readVarint(&cursor);
+            ComponentMask mask = readVarint(&cursor);
+            uint32_t index = handle & 0xff;
+            if(!resolve || index >= ECS_MAX_SYSTEMS) break;
+            
+            // New systems are appended to the order, which is compact once updated.
+            updateSystems(ecs);
+            uint8_t count = ecs->systemOrderCount;
+            resolve(ecs, handle, mask, userData);
+            resolved[index] = ecs->systemOrderCount > count;
+            if(resolved[index]) systems[index] = ecs->systemOrder[ecs->systemOrderCount - 1];
+            break;
+        }
+        
+        case kJournalPhase:
+        case kJournalEnable:
+        case kJournalDestroySystem: {
+            uint32_t index = readVarint(&cursor) & 0xff;
+            uint32_t arg = kind == kJournalDestroySystem ? 0 : readVarint(&cursor);
+            if(index >= ECS_MAX_SYSTEMS || !resolved[index]) break;
+            if(!isSystemValid(ecs, systems[index])) break;
+            if(kind == kJournalPhase) {
+                ecsSetSystemPhase(ecs, systems[index], arg);
+            } else if(kind == kJournalEnable) {
+                ecsEnableSystem(ecs, systems[index], arg);
+            } else {
+                destroySystem(ecs, systems[index]);
+                resolved[index] = false;
+            }
+            break;
+        }
+        
+        case kJournalTick:
+            ecsTick(ecs);
+            break;
+            
+        case kJournalRunTick:
+            ecsRunTicks(ecs, 1, readVarint(&cursor));
+            break;
+        }
+    }
+    free(entities);
+}
+
+// MARK: - Command Buffers
+
+// Set while a parallel system runs on this thread, so that deferred commands go to its chunk.
+static ECS_THREAD_LOCAL ByteBuffer *currentCommands = NULL;
+
+static void writeCommand(ECS *ecs, CommandHeader header, const void *data) {
+    ByteBuffer *buffer = currentCommands ? currentCommands : &ecs->commands;
+    uint8_t *bytes = appendBytes(buffer, sizeof(header) + (data ? header.size : 0));
+    memcpy(bytes, &header, sizeof(header));
+    if(data) memcpy(bytes + sizeof(header), data, header.size);
+}
+
+void ecsDeferDestroy(ECS *ecs, Entity entity) {
+    writeCommand(ecs, (CommandHeader){ .entity = entity, .kind = kCommandDestroy }, NULL);
+}
+
+void ecsDeferAdd(ECS *ecs, Entity entity, ECSID id, const void *data) {
+    ASSERT(id < atomicLoad(&typeCount));
+    CommandHeader header = {
+        .entity = entity,
+        .size = rowSize(ecs, id),
+        .kind = kCommandAdd,
+        .id = id,
+    };
+    writeCommand(ecs, header, data);
+}
+
+void ecsDeferRemove(ECS *ecs, Entity entity, ECSID id) {
+    writeCommand(ecs, (CommandHeader){ .entity = entity, .kind = kCommandRemove, .id = id }, NULL);
+}
+
+static void applyCommands(ECS *ecs, ByteBuffer *buffer) {
+    size_t cursor = 0;
+    while(cursor < buffer->size) {
+        CommandHeader header;
+        memcpy(&header, buffer->data + cursor, sizeof(header));
+        cursor += sizeof(header);
+        const uint8_t *data = buffer->data + cursor;
+        if(header.kind == kCommandAdd) cursor += header.size;
+        
+        // An earlier command may have destroyed the entity.
+        if(!isEntityValid(ecs, header.entity)) continue;
+        switch(header.kind) {
+        case kCommandDestroy:
+            destroyEntity(ecs, header.entity);
+            break;
+        case kCommandAdd: {
+            // The type's storage may have been declared since the command was written.
+            void *row = addComponentID(ecs, header.entity, header.id);
+            size_t size = rowSize(ecs, header.id);
+            if(size > header.size) size = header.size;
+            if(size) memcpy(row, data, size);
+            break;
+        }
+        case kCommandRemove:
+            removeComponentID(ecs, header.entity, header.id);
+            break;
+        }
+    }
+    buffer->size = 0;
+}
+
+void ecsFlushCommands(ECS *ecs) {
+    applyCommands(ecs, &ecs->commands);
+}
+
+// MARK: - Systems and matchers
+
+static ECSSystem systemHandle(uint8_t index, uint32_t generation) {
+    return (generation << 8) | index;
+}
+
+static System *findSystem(ECS *ecs, ECSSystem handle) {
+    uint32_t index = handle & 0xff;
+    if(index >= ECS_MAX_SYSTEMS) return NULL;
+    System *sys = &ecs->systems.data[index];
+    return sys->alive && sys->generation == (handle >> 8) ? sys : NULL;
+}
+
+// Systems run in creation order. Destroying a system leaves its handle in `systemOrder`, and
+// toggling one doesn't touch the active list: both are cleaned up before the next tick.
+static void updateSystems(ECS *ecs) {
+    if(!ecs->systemsDirty) return;
+    
+    uint8_t count = 0;
+    ecs->activeSystemCount = 0;
+    for(uint8_t i = 0; i < ecs->systemOrderCount; ++i) {
+        ECSSystem handle = ecs->systemOrder[i];
+        const System *sys = findSystem(ecs, handle);
+        if(!sys) continue;
+        
+        ecs->systemOrder[count++] = handle;
+        if(sys->enabled) ecs->activeSystems[ecs->activeSystemCount++] = sys;
+    }
+    ecs->systemOrderCount = count;
+    ecs->systemsDirty = false;
+}
+
+ECSSystem newSystem(ECS *ecs, ComponentMask mask, ECSIterator it, void *data) {
+    ASSERT(it != NULL);
+    if(ecs->systemOrderCount == ECS_MAX_SYSTEMS) updateSystems(ecs);
+    
+    Index index = newSystemFromPool(&ecs->systems);
+    System *sys = &ecs->systems.data[index];
+    *sys = (System) {
+        .generation = sys->generation,
+        .mask = mask,
+        .func = it,
+        .userData = data,
+        .phases = 1,
+        .parallel = false,
+        .enabled = true,
+        .alive = true,
+    };
+    
+    ECSSystem handle = systemHandle(index, sys->generation);
+    ecs->systemOrder[ecs->systemOrderCount++] = handle;
+    ecs->systemsDirty = true;
+    if(ecs->journal) journalRecord(ecs, kJournalSystem, handle, mask);
+    return handle;
+}
+
+void destroySystem(ECS *ecs, ECSSystem handle) {
+    System *sys = findSystem(ecs, handle);
+    if(!sys) return;
+    
+    sys->alive = false;
+    sys->generation = (sys->generation + 1) & 0xffffff;
+    returnSystemToPool(&ecs->systems, handle & 0xff);
+    ecs->systemsDirty = true;
+    if(ecs->journal) journalRecord(ecs, kJournalDestroySystem, handle, 0);
+}
+
+bool isSystemValid(ECS *ecs, ECSSystem handle) {
+    return findSystem(ecs, handle) != NULL;
+}
+
+void ecsEnableSystem(ECS *ecs, ECSSystem handle, bool enabled) {
+    System *sys = findSystem(ecs, handle);
+    ASSERT(sys != NULL);
+    if(sys->enabled == enabled) return;
+    sys->enabled = enabled;
+    ecs->systemsDirty = true;
+    if(ecs->journal) journalRecord(ecs, kJournalEnable, handle, enabled);
+}
+
+void ecsSetSystemParallel(ECS *ecs, ECSSystem handle, bool parallel) {
+    System *sys = findSystem(ecs, handle);
+    ASSERT(sys != NULL);
+    sys->parallel = parallel;
+}
+
+void ecsSetSystemPhase(ECS *ecs, ECSSystem handle, uint32_t phases) {
+    System *sys = findSystem(ecs, handle);
+    ASSERT(sys != NULL);
+    sys->phases = phases;
+    if(ecs->journal) journalRecord(ecs, kJournalPhase, handle, phases);
+}
+
+void ecsSetSystemFusion(ECS *ecs, bool fuse) {
+    ecs->fuseSystems = fuse;
+}
+
+void ecsSetWorkerPool(ECS *ecs, ECSWorkerPool *pool, bool deterministic) {
+    ecs->pool = pool;
+    ecs->deterministic = deterministic;
+}
+
+typedef struct {
+    ECS             *ecs;
+    const System    *system;
+} ParallelRun;
+
+static void runChunk(unsigned chunk, unsigned worker, void *data) {
+    const ParallelRun *run = data;
+    ECS *ecs = run->ecs;
+    currentCommands = &ecs->chunkCommands[ecs->deterministic ? chunk : worker];
+    
+    uint32_t first = chunk * (ECS_PARALLEL_CHUNK / 64);
+    uint32_t last = first + ECS_PARALLEL_CHUNK / 64;
+    if(last > ECS_BITMAP_WORDS) last = ECS_BITMAP_WORDS;
+    Prefetcher prefetcher;
+    initPrefetcher(&prefetcher, ecs, run->system->mask, first, last);
+    
+    for(uint32_t w = first; w < last; ++w) {
+        uint64_t alive = matchingEntities(ecs, run->system->mask, w);
+        while(alive) {
+            Index id = w * 64 + __builtin_ctzll(alive);
+            alive &= alive - 1;
+            prefetchNext(&prefetcher);
+            
+            EntityData entity = ecs->entities.data[id];
+            if((entity.components & run->system->mask) != run->system->mask) continue;
+            run->system->func(ecs, createHandle(id, generation(entity)), run->system->userData);
+        }
+    }
+    currentCommands = NULL;
+}
+
+// Splits the entity table in fixed chunks. In deterministic mode each chunk gets its own command
+// buffer and buffers are applied in chunk order, which is the order a single thread would have
+// recorded the commands in. Otherwise, each worker gets a buffer.
+static void runParallelSystem(ECS *ecs, const System *sys) {
+    unsigned chunks = (ecs->entities.nextUnused + ECS_PARALLEL_CHUNK - 1) / ECS_PARALLEL_CHUNK;
+    unsigned buffers = ecs->deterministic ? chunks : workerPoolSize(ecs->pool);
+    
+    if(buffers > ecs->chunkCommandCount) {
+        ecs->chunkCommands = realloc(ecs->chunkCommands, buffers * sizeof(ByteBuffer));
+        for(uint32_t i = ecs->chunkCommandCount; i < buffers; ++i) {
+            ecs->chunkCommands[i] = (ByteBuffer){ 0 };
+        }
+        ecs->chunkCommandCount = buffers;
+    }
+    
+    ParallelRun run = { .ecs = ecs, .system = sys };
+    workerPoolRun(ecs->pool, chunks, runChunk, &run);
+    for(unsigned i = 0; i < buffers; ++i) {
+        applyCommands(ecs, &ecs->chunkCommands[i]);
+    }
+}
+
+// Calls each system of a group for each entity in one pass. An entity destroyed or changed by one
+// of the systems is re-checked before the next one is called for it.
+static void runFused(ECS *ecs, const System *const *group, uint8_t count) {
+    ComponentMask mask = group[0]->mask;
+    Prefetcher prefetcher;
+    initPrefetcher(&prefetcher, ecs, mask, 0, ECS_BITMAP_WORDS);
+    
+    for(uint32_t w = 0; w < ECS_BITMAP_WORDS; ++w) {
+        uint64_t alive = matchingEntities(ecs, mask, w);
+        while(alive) {
+            Index id = w * 64 + __builtin_ctzll(alive);
+            alive &= alive - 1;
+            prefetchNext(&prefetcher);
+            
+            for(uint8_t i = 0; i < count; ++i) {
+                EntityData data = ecs->entities.data[id];
+                if(!bitTest(ecs->alive, id) || (data.components & mask) != mask) break;
+                group[i]->func(ecs, createHandle(id, generation(data)), group[i]->userData);
+            }
+            alive &= ecs->alive[w];
+        }
+    }
+}
+
+static void runSystems(ECS *ecs, const System *const *systems, uint8_t count) {
+    for(uint8_t i = 0; i < count;) {
+        const System *sys = systems[i];
+        uint8_t fused = 1;
+        if(sys->parallel && ecs->pool) {
+            runParallelSystem(ecs, sys);
+        } else if(ecs->fuseSystems) {
+            while(i + fused < count && systems[i + fused]->mask == sys->mask
+                  && !(systems[i + fused]->parallel && ecs->pool)) fused += 1;
+            runFused(ecs, systems + i, fused);
+        } else {
+            matchEntities(ecs, sys->mask, sys->func, sys->userData);
+        }
+        applyCommands(ecs, &ecs->commands);
+        i += fused;
+    }
+}
+
+// Runs one tick of a schedule. Only changes made outside of systems are journaled, before the
+// tick's marker: replaying the journal runs the systems again. Ticks that only run some phases
+// are recorded with them.
+static void runTick(ECS *ecs, const System *const *systems, uint8_t count, uint8_t kind,
+                    uint32_t phases) {
+    ECSJournal *journal = ecs->journal;
+    if(journal) journalWrites(ecs);
+    ecs->journal = NULL;
+    runSystems(ecs, systems, count);
+    ecs->journal = journal;
+    if(journal) journalRecord(ecs, kind, phases, 0);
+}
+
+void ecsTick(ECS *ecs) {
+    updateSystems(ecs);
+    runTick(ecs, ecs->activeSystems, ecs->activeSystemCount, kJournalTick, 0);
+    if(ecs->hasSnapshots) publishSnapshot(ecs);
+    ecs->tick += 1;
+}
+
+void ecsRunTicks(ECS *ecs, uint32_t count, uint32_t phases) {
+    if(!count) return;
+    
+    // The schedule can't change during the run, so it's only built once.
+    const System *schedule[ECS_MAX_SYSTEMS];
+    uint8_t scheduled = 0;
+    updateSystems(ecs);
+    for(uint8_t i = 0; i < ecs->activeSystemCount; ++i) {
+        if(ecs->activeSystems[i]->phases & phases) schedule[scheduled++] = ecs->activeSystems[i];
+    }
+    
+    for(uint32_t t = 0; t < count; ++t) {
+        runTick(ecs, schedule, scheduled, kJournalRunTick, phases);
+        ecs->tick += 1;
+    }
+    // Only the final state is worth presenting.
+    if(ecs->hasSnapshots) publishSnapshot(ecs);
+}
+
+void matchEntities(ECS *ecs, ComponentMask mask, ECSIterator it, void *userData) {
+    Prefetcher prefetcher;
+    initPrefetcher(&prefetcher, ecs, mask, 0, ECS_BITMAP_WORDS);
+    
+    for(uint32_t w = 0; w < ECS_BITMAP_WORDS; ++w) {
+        uint64_t alive = matchingEntities(ecs, mask, w);
+        while(alive) {
+            Index id = w * 64 + __builtin_ctzll(alive);
+            alive &= alive - 1;
+            prefetchNext(&prefetcher);
+            
+            EntityData data = ecs->entities.data[id];
+            if((data.components & mask) != mask) continue;
+            it(ecs, createHandle(id, generation(data)), userData);
+            alive &= ecs->alive[w];
+        }
+    }
+}
+
+// MARK: - Memory Statistics
+
+void ecsMemoryStats(const ECS *ecs, ECSMemoryStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->entities = sizeof(ecs->entities);
+    stats->systems = sizeof(ecs->systems);
+    stats->indices = sizeof(ecs->alive);
+    stats->total = sizeof(*ecs);
+    stats->entityCapacity = ECS_MAX_ENTITIES;
+    
+    if(ecs->hashing) {
+        stats->indices += (ECS_MAX_COMPS + 1) * ECS_MAX_ENTITIES * sizeof(DirtyRow);
+        for(uint8_t i = 0; i <= ECS_MAX_COMPS; ++i) {
+            if(ecs->hashSlots[i]) stats->indices += sizeof(HashSlot);
+        }
+        stats->total += stats->indices - sizeof(ecs->alive);
+    }
+    
+    for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+        const ComponentData *comp = ecs->compData[i];
+        if(!comp) continue;
+        ECSComponentStats *compStats = &stats->components[i];
+        
+        bool table = comp->storage == kStorageTable || comp->storage == kStorageTag;
+        compStats->capacity = table || comp->storage == kStorageInline ? ECS_MAX_ENTITIES : comp->capacity;
+        compStats->data = comp->storage == kStorageInline ? 0 : compStats->capacity * comp->size;
+        compStats->indices = sizeof(ComponentData) + comp->bucketCount * sizeof(HashBucket);
+        if(comp->slotOf) compStats->indices += ECS_MAX_ENTITIES * sizeof(Index);
+        if(comp->entityAt) compStats->indices += comp->capacity * sizeof(Index);
+        if(comp->changes) compStats->indices += sizeof(ChangeLog);
+        if(comp->bits) compStats->data = ECS_BITMAP_WORDS * comp->bitWidth * sizeof(uint64_t);
+        if(comp->snapshot) {
+            compStats->data += 2 * ECS_MAX_ENTITIES * comp->size;
+            compStats->indices += sizeof(Snapshot);
+        }
+        stats->total += compStats->data + compStats->indices;
+    }
+    
+    for(uint32_t w = 0; w < ECS_BITMAP_WORDS; ++w) {
+        uint64_t alive = ecs->alive[w];
+        while(alive) {
+            Index id = w * 64 + __builtin_ctzll(alive);
+            alive &= alive - 1;
+            
+            ComponentMask components = ecs->entities.data[id].components;
+            stats->liveEntities += 1;
+            for(uint8_t i = 0; i < ECS_MAX_COMPS; ++i) {
+                if(components & (1 << i)) stats->components[i].live += 1;
+            }
+        }
+    }
+}
+
+// MARK: - Worker Pool
+
+struct ECSWorkerPool {
+    unsigned                threadCount;
+    ECSJob                  *job;
+    void                    *userData;
+    unsigned                jobCount;
+    ECS_ATOMIC(unsigned)    nextJob;
+#if ECS_THREADS
+    pthread_t               *threads;
+    pthread_mutex_t         runLock;
+    pthread_mutex_t         lock;
+    pthread_cond_t          start;
+    pthread_cond_t          done;
+    unsigned                run;
+    unsigned                busy;
+    bool                    quit;
+#endif
+};
+
+static void runJobs(ECSWorkerPool *pool, unsigned worker) {
+    unsigned index;
+    while((index = atomicAdd(&pool->nextJob, 1)) < pool->jobCount) {
+        pool->job(index, worker, pool->userData);
+    }
+}
+
+#if ECS_THREADS
+typedef struct {
+    ECSWorkerPool   *pool;
+    unsigned        worker;
+} WorkerStart;
+
+static void *workerMain(void *arg) {
+    WorkerStart start = *(WorkerStart *)arg;
+    free(arg);
+    ECSWorkerPool *pool = start.pool;
+    unsigned seen = 0;
+    
+    for(;;) {
+        pthread_mutex_lock(&pool->lock);
+        while(pool->run == seen && !pool->quit) pthread_cond_wait(&pool->start, &pool->lock);
+        if(pool->quit) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->run;
+        pthread_mutex_unlock(&pool->lock);
+        
+        runJobs(pool, start.worker);
+        
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->busy == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+#endif
+
+ECSWorkerPool *newWorkerPool(unsigned threads) {
+    ASSERT(threads > 0);
+    ECSWorkerPool *pool = malloc(sizeof(*pool));
+    pool->job = NULL;
+    pool->userData = NULL;
+    pool->jobCount = 0;
+    pool->nextJob = 0;
+#if ECS_THREADS
+    pool->threadCount = threads;
+    pool->run = 0;
+    pool->busy = 0;
+    pool->quit = false;
+    pthread_mutex_init(&pool->runLock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    
+    pool->threads = malloc(threads * sizeof(pthread_t));
+    for(unsigned i = 0; i < threads; ++i) {
+        WorkerStart *start = malloc(sizeof(*start));
+        *start = (WorkerStart){ .pool = pool, .worker = i };
+        pthread_create(&pool->threads[i], NULL, workerMain, start);
+    }
+#else
+    (void)threads;
+    pool->threadCount = 1;
+#endif
+    return pool;
+}
+
+void destroyWorkerPool(ECSWorkerPool *pool) {
+#if ECS_THREADS
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for(unsigned i = 0; i < pool->threadCount; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->runLock);
+#endif
+    free(pool);
+}
+
+unsigned workerPoolSize(const ECSWorkerPool *pool) {
+    return pool->threadCount;
+}
+
+void workerPoolRun(ECSWorkerPool *pool, unsigned count, ECSJob job, void *data) {
+#if ECS_THREADS
+    // Worlds ticked by a group may share a pool for their parallel systems: runs take turns.
+    pthread_mutex_lock(&pool->runLock);
+#endif
+    pool->job = job;
+    pool->userData = data;
+    pool->jobCount = count;
+    pool->nextJob = 0;
+#if ECS_THREADS
+    pthread_mutex_lock(&pool->lock);
+    pool->busy = pool->threadCount;
+    pool->run += 1;
+    pthread_cond_broadcast(&pool->start);
+    while(pool->busy) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->runLock);
+#else
+    runJobs(pool, 0);
+#endif
+}
+
+// MARK: - World Groups
+
+typedef struct {
+    ECS             *ecs;
+    bool            active;
+    unsigned        worker;
+    double          cost;
+} GroupWorld;
+
+typedef struct {
+    unsigned                *worlds;
+    unsigned                count;
+    ECS_ATOMIC(unsigned)    next;
+} WorkerQueue;
+
+struct ECSWorldGroup {
+    ECSWorkerPool   *pool;
+    GroupWorld      *worlds;
+    unsigned        worldCount;
+    unsigned        capacity;
+    WorkerQueue     *queues;
+    double          *load;
+    GroupWorld      **order;
+};
+
+ECSWorldGroup *newWorldGroup(ECSWorkerPool *pool) {
+    unsigned workers = workerPoolSize(pool);
+    ECSWorldGroup *group = malloc(sizeof(*group));
+    group->pool = pool;
+    group->worlds = NULL;
+    group->worldCount = 0;
+    group->capacity = 0;
+    group->order = NULL;
+    group->queues = calloc(workers, sizeof(WorkerQueue));
+    group->load = calloc(workers, sizeof(double));
+    return group;
+}
+
+void destroyWorldGroup(ECSWorldGroup *group) {
+    for(unsigned i = 0; i < workerPoolSize(group->pool); ++i) {
+        free(group->queues[i].worlds);
+    }
+    free(group->queues);
+    free(group->load);
+    free(group->order);
+    free(group->worlds);
+    free(group);
+}
+
+static GroupWorld *findGroupWorld(ECSWorldGroup *group, ECS *ecs) {
+    for(unsigned i = 0; i < group->worldCount; ++i) {
+        if(group->worlds[i].ecs == ecs) return &group->worlds[i];
+    }
+    return NULL;
+}
+
+void worldGroupAdd(ECSWorldGroup *group, ECS *ecs) {
+    if(findGroupWorld(group, ecs)) return;
+    
+    if(group->worldCount == group->capacity) {
+        group->capacity = group->capacity ? group->capacity * 2 : 16;
+        group->worlds = realloc(group->worlds, group->capacity * sizeof(GroupWorld));
+        group->order = realloc(group->order, group->capacity * sizeof(GroupWorld *));
+        for(unsigned i = 0; i < workerPoolSize(group->pool); ++i) {
+            WorkerQueue *queue = &group->queues[i];
+            queue->worlds = realloc(queue->worlds, group->capacity * sizeof(unsigned));
+        }
+    }
+    
+    group->worlds[group->worldCount] = (GroupWorld){
+        .ecs = ecs,
+        .active = true,
+        .worker = group->worldCount % workerPoolSize(group->pool),
+        .cost = 0,
+    };
+    group->worldCount += 1;
+}
+
+void worldGroupRemove(ECSWorldGroup *group, ECS *ecs) {
+    GroupWorld *world = findGroupWorld(group, ecs);
+    if(!world) return;
+    *world = group->worlds[--group->worldCount];
+}
+
+void worldGroupSetActive(ECSWorldGroup *group, ECS *ecs, bool active) {
+    GroupWorld *world = findGroupWorld(group, ecs);
+    ASSERT(world != NULL);
+    world->active = active;
+}
+
+static int compareWorldCost(const void *a, const void *b) {
+    double costA = (*(GroupWorld *const *)a)->cost;
+    double costB = (*(GroupWorld *const *)b)->cost;
+    return (costA < costB) - (costA > costB);
+}
+
+// Longest-first greedy assignment. A world stays on its previous worker unless that would push the
+// worker past the average load by more than a quarter.
+static void scheduleWorlds(ECSWorldGroup *group) {
+    unsigned workers = workerPoolSize(group->pool);
+    unsigned count = 0;
+    double total = 0;
+    for(unsigned i = 0; i < group->worldCount; ++i) {
+        if(!group->worlds[i].active) continue;
+        group->order[count++] = &group->worlds[i];
+        total += group->worlds[i].cost;
+    }
+    qsort(group->order, count, sizeof(GroupWorld *), compareWorldCost);
+    
+    for(unsigned i = 0; i < workers; ++i) {
+        group->queues[i].count = 0;
+        group->queues[i].next = 0;
+        group->load[i] = 0;
+    }
+    
+    double limit = 1.25 * total / workers;
+    for(unsigned i = 0; i < count; ++i) {
+        GroupWorld *world = group->order[i];
+        unsigned worker = world->worker;
+        if(group->load[worker] + world->cost > limit) {
+            for(unsigned j = 0; j < workers; ++j) {
+                if(group->load[j] < group->load[worker]) worker = j;
+            }
+        }
+        
+        WorkerQueue *queue = &group->queues[worker];
+        queue->worlds[queue->count++] = world - group->worlds;
+        group->load[worker] += world->cost;
+    }
+}
+
+#if ECS_THREADS
+static double currentTime(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+#endif
+
+static void tickGroupWorld(GroupWorld *world, unsigned worker) {
+#if ECS_THREADS
+    double start = currentTime();
+    ecsTick(world->ecs);
+    double cost = currentTime() - start;
+    world->cost = world->cost ? 0.75 * world->cost + 0.25 * cost : cost;
+#else
+    ecsTick(world->ecs);
+#endif
+    world->worker = worker;
+}
+
+static void runWorkerQueue(ECSWorldGroup *group, WorkerQueue *queue, unsigned worker) {
+    unsigned next;
+    while((next = atomicAdd(&queue->next, 1)) < queue->count) {
+        tickGroupWorld(&group->worlds[queue->worlds[next]], worker);
+    }
+}
+
+static void worldGroupJob(unsigned index, unsigned worker, void *data) {
+    (void)index;
+    ECSWorldGroup *group = data;
+    unsigned workers = workerPoolSize(group->pool);
+    
+    // Drain our own queue first, then help whoever is still busy.
+    for(unsigned i = 0; i < workers; ++i) {
+        runWorkerQueue(group, &group->queues[(worker + i) % workers], worker);
+    }
+}
+
+void worldGroupTick(ECSWorldGroup *group) {
+    scheduleWorlds(group);
+    workerPoolRun(group->pool, workerPoolSize(group->pool), worldGroupJob, group);
 }
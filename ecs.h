@@ -31,6 +31,46 @@ extern "C" {
 #define ECS_MAX_SYSTEMS     (32)
 #endif
 
+#ifndef ECS_THREADS
+#define ECS_THREADS         (0)
+#endif
+
+#ifndef ECS_PARALLEL_CHUNK
+#define ECS_PARALLEL_CHUNK  (256)
+#endif
+
+#ifndef ECS_INLINE_BYTES
+#define ECS_INLINE_BYTES    (0)
+#endif
+
+#ifndef ECS_PREFETCH_DISTANCE
+#define ECS_PREFETCH_DISTANCE (8)
+#endif
+
+#if ECS_PARALLEL_CHUNK % 64 != 0
+#error "ECS_PARALLEL_CHUNK must be a multiple of 64"
+#endif
+
+#ifndef ECS_HANDLE_BITS
+#define ECS_HANDLE_BITS     (32)
+#endif
+
+#ifndef ECS_INDEX_BITS
+#define ECS_INDEX_BITS      (ECS_HANDLE_BITS / 2)
+#endif
+
+#define ECS_GEN_BITS        (ECS_HANDLE_BITS - ECS_INDEX_BITS)
+#define ECS_INDEX_MASK      ((((Entity)1) << ECS_INDEX_BITS) - 1)
+#define ECS_GEN_MASK        ((((Entity)1) << ECS_GEN_BITS) - 1)
+
+#if ECS_INDEX_BITS >= ECS_HANDLE_BITS || ECS_INDEX_BITS < 1
+#error "ECS_INDEX_BITS must leave room for the generation in the entity handle"
+#endif
+
+#if ECS_MAX_ENTITIES > (1 << ECS_INDEX_BITS)
+#error "ECS_MAX_ENTITIES does not fit in ECS_INDEX_BITS"
+#endif
+
 #define ECS_COMPMASK_BYTES  (1 + (ECS_MAX_COMPS-1)/8)
 #define ECS_ALL_COMP_MASK   ((1 << ECS_MAX_COMPS) - 1)
 
@@ -42,12 +82,72 @@ typedef uint16_t ComponentMask;
 typedef uint32_t ComponentMask;
 #endif
 
-typedef uint8_t     ECSID;
-typedef uint16_t    Index;
+#if ECS_HANDLE_BITS == 64
+typedef uint64_t    Entity;
+#elif ECS_HANDLE_BITS == 32
 typedef uint32_t    Entity;
+#elif ECS_HANDLE_BITS == 16
+typedef uint16_t    Entity;
+#else
+#error "ECS_HANDLE_BITS must be 16, 32 or 64"
+#endif
+
+#if ECS_INDEX_BITS <= 8
+typedef uint8_t     Index;
+#elif ECS_INDEX_BITS <= 16
+typedef uint16_t    Index;
+#else
+typedef uint32_t    Index;
+#endif
+
+#if ECS_GEN_BITS <= 8
+typedef uint8_t     Generation;
+#elif ECS_GEN_BITS <= 16
+typedef uint16_t    Generation;
+#else
+typedef uint32_t    Generation;
+#endif
+
+typedef uint8_t     ECSID;
+typedef uint32_t    ECSSystem;
+
+// How a registry stores a component type. Tables index rows by entity, which is the fastest but
+// costs `ECS_MAX_ENTITIES` rows. Sparse sets and hash maps only store the rows in use, behind an
+// entity-to-row map that is a direct table for sparse sets and a hash table for hash maps. Tags
+// store no data at all, only the bit per entity that every kind of storage uses to tell which
+// entities have the component, which queries test 64 entities at a time. Inline components are
+// stored in the entity table itself, next to the entity's component mask, and share its
+// `ECS_INLINE_BYTES` bytes. Bit-packed components hold a value of 1, 2, 4 or 8 bits, set through
+// `ecsSetBits`, on top of that bit. Once a registry extracts, replicates or journals its changes,
+// every kind of storage also costs about `4 + sizeof(Generation)` bytes per entity to track them.
+typedef enum {
+    kStorageTable,
+    kStorageSparse,
+    kStorageHash,
+    kStorageTag,
+    kStorageInline,
+    kStorageBits,
+} ECSStorage;
 typedef struct ECS  ECS;
+typedef struct ECSPacket ECSPacket;
+typedef struct ECSReplicator ECSReplicator;
+typedef struct ECSJournal ECSJournal;
+
+// A reference to an entity's component that can be kept across ticks. It caches the component's
+// address along with the version of the component's storage it was valid for.
+typedef struct {
+    Entity      entity;
+    ECSID       id;
+    uint32_t    version;
+    void        *data;
+} ComponentRef;
+typedef struct ECSWorkerPool ECSWorkerPool;
+typedef struct ECSWorldGroup ECSWorldGroup;
 
 typedef void ECSIterator(ECS *, Entity, void *);
+typedef void ECSSnapshotIterator(const ECS *, Index, void *);
+typedef void ECSJob(unsigned, unsigned, void *);
+typedef void ECSSystemResolver(ECS *, ECSSystem, ComponentMask, void *);
 
 #ifdef NDEBUG
 #define ASSERT(expr)
@@ -55,7 +155,13 @@ typedef void ECSIterator(ECS *, Entity, void *);
 #define ASSERT(expr) assertImpl(__FILE__, __LINE__, #expr, expr)
 #endif
 
+#define ECS_REGISTER(T) ecsRegisterComponent(#T, sizeof(T))
 #define ECS_COMPONENT(ecs, T) ecsDeclareComponent(ecs, #T, sizeof(T))
+// Bit-packed types declared through `ECS_COMPONENT_STORAGE` are as wide as `T`. Narrower ones are
+// declared with `ECS_COMPONENT_BITS`.
+#define ECS_COMPONENT_STORAGE(ecs, T, storage) ecsDeclareComponentStorage(ecs, #T, \
+    (storage) == kStorageBits ? 8 * sizeof(T) : sizeof(T), storage)
+#define ECS_COMPONENT_BITS(ecs, T, bits) ecsDeclareComponentStorage(ecs, #T, bits, kStorageBits)
 #define ECS_ID(ecs, T) ecsComponentID(ecs, #T)
 #define ECS_MASK(ecs, T) (1 << ECS_ID(ecs, T))
 
@@ -83,7 +189,17 @@ void destroyECS(ECS *ecs);
 ComponentMask componentMask(unsigned count, ...);
 
 /**
- * Registers a new type of component that can be attached to entities.
+ * Registers a new type of component that can be attached to entities. Component types are shared
+ * by every registry in the process: a type has the same ID, and masks the same meaning, in all of
+ * them. Registries allocate a type's table the first time it is used.
+ * @param id The string identifying the component type.
+ * @param size The size of the type's components.
+ * @return A unique identifier for the component type.
+ */
+ECSID ecsRegisterComponent(const char *id, size_t size);
+
+/**
+ * Registers a new type of component, and allocates its table in a registry.
  * @param ecs The ECS regsitry in which to register the component type.
  * @param id The string identifying the component type.
  * @param size The size of the type's components.
@@ -92,10 +208,25 @@ ComponentMask componentMask(unsigned count, ...);
 ECSID ecsDeclareComponent(ECS *ecs, const char *id, size_t size);
 
 /**
- * Returns the unique identifier for a component type.
+ * Registers a new type of component, and allocates its storage in a registry with a given kind of
+ * storage. Rare components can use a sparse set or a hash map to avoid paying for a full table.
+ * Components stored in a sparse set or a hash map can't be buffered, and their rows move when
+ * others are removed.
+ * @param ecs The ECS regsitry in which to register the component type.
+ * @param id The string identifying the component type.
+ * @param size The size of the type's components, ignored for tags, or their width in bits for
+ *             bit-packed components.
+ * @param storage How the registry stores the type's components.
+ * @return A unique identifier for the component type.
+ */
+ECSID ecsDeclareComponentStorage(ECS *ecs, const char *id, size_t size, ECSStorage storage);
+
+/**
+ * Returns the unique identifier for a component type. Since component types are shared by every
+ * registry, the result can be cached and reused across registries.
  * @param ecs The registry in which the component type is registered.
  * @param id The string identifiying the component type.
- * @return A unique identifier for the component type.
+ * @return A unique identifier for the component type, or `ECS_MAX_COMPS` if it isn't registered.
  */
 ECSID ecsComponentID(const ECS *ecs, const char *id);
 
@@ -104,8 +235,8 @@ ECSID ecsComponentID(const ECS *ecs, const char *id);
  * @param handle The entity handle.
  * @return The index into the component tables associated with the entity.
  */
-static inline uint16_t entityIndex(Entity handle) {
-    return handle & 0xffff;
+static inline Index entityIndex(Entity handle) {
+    return handle & ECS_INDEX_MASK;
 }
 
 /**
@@ -114,8 +245,8 @@ static inline uint16_t entityIndex(Entity handle) {
  * @param handle The entity handle.
  * @return The index into the component tables associated with the entity.
  */
-static inline uint16_t entityGen(Entity handle) {
-    return (handle >> 16) & 0xffff;
+static inline Generation entityGen(Entity handle) {
+    return (handle >> ECS_INDEX_BITS) & ECS_GEN_MASK;
 }
 
 /**
@@ -125,6 +256,23 @@ static inline uint16_t entityGen(Entity handle) {
  */
 Entity newEntity(ECS *ecs);
 
+/**
+ * Creates several entities at once in `ecs`. This is lock-free and can be called from several
+ * threads at the same time, as can `newEntity`, provided no entity is destroyed concurrently.
+ * Components stored in tables, inline or as tags can then be added to and written for the new
+ * entities from the reserving thread, as long as the registry already uses the component's type
+ * and no group owns it. Other kinds of storage, and journaling, are not thread-safe.
+ * All `count` entities come either from those destroyed earlier or from those never used yet, so
+ * this can fail even when both together would hold enough, e.g. 2 destroyed and 2 never used for
+ * a `count` of 3. Creating fewer at a time, down to `newEntity`, uses up every free entity.
+ * @param ecs the ecs "registry" to create the entities in.
+ * @param count The number of entities to create.
+ * @param entities An array that receives `count` handles to the new entities.
+ * @return Whether the entities were created, false if neither destroyed entities nor unused ones
+ *         number at least `count`. Nothing is created then.
+ */
+bool reserveEntities(ECS *ecs, uint32_t count, Entity *entities);
+
 /**
  * Creates a new entity with a list of components in `ecs`, and returns a handle to it
  * @param ecs The ecs "registry" to create the entity in.
@@ -140,6 +288,30 @@ Entity newEntityWithArchetype(ECS *ecs, ComponentMask archetype);
  */
 void destroyEntity(ECS *ecs, Entity entity);
 
+/**
+ * Destroys every entity in `ecs` at once. Component types, buffered components and systems are
+ * kept, and handles to the destroyed entities become invalid.
+ * @param ecs The ECS registry to clear.
+ */
+void ecsClear(ECS *ecs);
+
+/**
+ * Creates a new entity with a copy of all of an entity's components.
+ * @param ecs The ECS registry that `entity` belongs to.
+ * @param entity The handle of the entity to clone.
+ * @return The handle to the new entity.
+ */
+Entity ecsCloneEntity(ECS *ecs, Entity entity);
+
+/**
+ * Moves an entity and all of its components from one ECS registry to another.
+ * @param src The ECS registry that `entity` belongs to.
+ * @param dst The ECS registry to move the entity to.
+ * @param entity The handle of the entity to move. It is invalid in `src` afterwards.
+ * @return The handle to the entity in `dst`.
+ */
+Entity ecsMoveEntity(ECS *src, ECS *dst, Entity entity);
+
 /**
  * Adds a component identified by `id` to an entity.
  * @param ecs The ECS registry in which the entity and compoennt type are registered.
@@ -150,16 +322,29 @@ void destroyEntity(ECS *ecs, Entity entity);
 void *addComponentID(ECS *ecs, Entity entity, ECSID id);
 
 /**
- * Adds a component identified by `id` to an entity.
+ * Adds several components to an entity at once, which is cheaper than adding them one by one when
+ * some of them are packed.
+ * @param ecs The ECS registry in which the entity and component types are registered.
+ * @param entity The entity to which the components are to be added.
+ * @param mask The set of component types to add.
+ * @param components Receives a pointer to each new component's data, in order of component IDs,
+ *                   or NULL.
+ */
+void addComponentsID(ECS *ecs, Entity entity, ComponentMask mask, void **components);
+
+/**
+ * Adds a component identified by `id` to an entity. The type keeps whatever storage the registry
+ * declared for it, or gets a table if it hasn't been declared.
  * @param ecs The ECS registry in which the entity and compoennt type are registered.
  * @param entity The entity to which the component is to be added.
  * @param T The new component's type.
  * @return A pointer to the new component's data.
  */
-#define addComponent(ecs, entity, T) ((T *)addComponentID((ecs), (entity), ECS_COMPONENT(ecs, T)))
+#define addComponent(ecs, entity, T) ((T *)addComponentID((ecs), (entity), ECS_REGISTER(T)))
 
 /**
- * Returns a pointer to a entity's given component's data.
+ * Returns a pointer to a entity's given component's data. The row is marked as written, since
+ * the caller may write to it: use `readComponentID` for read-only access.
  * @param ecs The ECS registry in which the entity and compoennt type are registered.
  * @param entity The entity for which to get the component's data.
  * @param id The unique ID of the component's type.
@@ -174,7 +359,27 @@ void *getComponentID(ECS *ecs, Entity entity, ECSID id);
  * @param T  The component's type.
  * @return A pointer to the component's data.
  */
-#define getComponent(ecs, entity, T) ((T *)addComponentID((ecs), (entity), ECS_COMPONENT(ecs, T)))
+#define getComponent(ecs, entity, T) ((T *)getComponentID((ecs), (entity), ECS_REGISTER(T)))
+
+/**
+ * Returns a pointer to an entity's given component's data, for reading only. Unlike
+ * `getComponentID`, the row isn't marked as written, so it won't be extracted, replicated,
+ * journaled or hashed again because of this access.
+ * @param ecs The ECS registry in which the entity and component type are registered.
+ * @param entity The entity for which to read the component's data.
+ * @param id The unique ID of the component's type.
+ * @return A pointer to the component's data, or NULL if the entity doesn't have the component.
+ */
+const void *readComponentID(const ECS *ecs, Entity entity, ECSID id);
+
+/**
+ * Returns a pointer to an entity's given component's data, for reading only.
+ * @param ecs The ECS registry in which the entity and component type are registered.
+ * @param entity The entity for which to read the component's data.
+ * @param T  The component's type.
+ * @return A pointer to the component's data, or NULL if the entity doesn't have the component.
+ */
+#define readComponent(ecs, entity, T) ((const T *)readComponentID((ecs), (entity), ECS_REGISTER(T)))
 
 /**
  * Removes a component from a given entity.
@@ -190,7 +395,7 @@ void removeComponentID(ECS *ecs, Entity entity, ECSID id);
  * @param entity The entity for which to remove the component.
  * @param T  The component's type.
  */
-#define removeComponent(ecs, entity, T) removeComponentID((ecs), (entity), ECS_COMPONENT(ecs, T))
+#define removeComponent(ecs, entity, T) removeComponentID((ecs), (entity), ECS_REGISTER(T))
 
 /**
  * Returns whether a handle points to an valid, active entity.
@@ -216,23 +421,498 @@ void matchEntities(ECS *ecs, ComponentMask mask, ECSIterator func, void *data);
  * @param mask A set of component types that the new system will operate on.
  * @param func A function called for each entity matching the system's component set.
  * @param data An arbitrary pointer passed to the system's function.
- * @return A unique identifier that refers to the system.
+ * @return A handle that refers to the system. Systems run in the order they were created in.
+ */
+ECSSystem newSystem(ECS *ecs, ComponentMask mask, ECSIterator func, void *data);
+
+/**
+ * Destroys a given system in the given ECS registry. The system's handle becomes invalid, even if
+ * its slot is reused by a new system.
+ * @param ecs The ECS registry in which the system exists.
+ * @param system The handle of the system to destroy.
+ */
+void destroySystem(ECS *ecs, ECSSystem system);
+
+/**
+ * Checks whether a system handle refers to a system that still exists.
+ * @param ecs The ECS registry in which the system was created.
+ * @param system The handle of the system.
+ * @return Whether the system still exists.
+ */
+bool isSystemValid(ECS *ecs, ECSSystem system);
+
+/**
+ * Enables or disables a system. Disabled systems keep their place in the run order, and are
+ * skipped by `ecsTick` until they are enabled again. Systems start enabled.
+ * @param ecs The ECS registry in which the system exists.
+ * @param system The handle of the system.
+ * @param enabled Whether the system runs.
+ */
+void ecsEnableSystem(ECS *ecs, ECSSystem system, bool enabled);
+
+/**
+ * Sets whether a system runs in parallel, split in chunks of `ECS_PARALLEL_CHUNK` entities, when
+ * the registry has a worker pool. Parallel systems may only write the components of the entity
+ * they are called for; structural changes must go through the `ecsDefer` functions.
+ * @param ecs The ECS registry in which the system exists.
+ * @param system The handle of the system.
+ * @param parallel Whether the system runs in parallel.
+ */
+void ecsSetSystemParallel(ECS *ecs, ECSSystem system, bool parallel);
+
+/**
+ * Sets whether consecutive systems with the same component set run in a single pass over the
+ * entities, calling each system's function in turn for each entity. Commands deferred by a fused
+ * group are applied when the whole group is done. Only enable this when such systems don't depend
+ * on each other's effects on other entities. Parallel systems are never fused.
+ * @param ecs The ECS registry.
+ * @param fuse Whether systems are fused.
  */
-ECSID newSystem(ECS *ecs, ComponentMask mask, ECSIterator func, void *data);
+void ecsSetSystemFusion(ECS *ecs, bool fuse);
 
 /**
- * Destroys a given system in the given ECS registry.
+ * Sets the phases a system belongs to, as a bitmask of application-defined phases (for example
+ * simulation and presentation). Systems start in phase `1`. Phases are only used by `ecsRunTicks`;
+ * `ecsTick` runs every system.
  * @param ecs The ECS registry in which the system exists.
- * @param id The unique identifier of the system to destroy.
+ * @param system The handle of the system.
+ * @param phases The bitmask of phases the system belongs to.
  */
-void destroySystem(ECS *ecs, ECSID id);
+void ecsSetSystemPhase(ECS *ecs, ECSSystem system, uint32_t phases);
 
 /**
- * Run all system in a given ECS registry once.
+ * Sets the worker pool used to run parallel systems.
+ * @param ecs The ECS registry.
+ * @param pool The worker pool, or NULL to run every system on the calling thread. It can be shared
+ *             with the registries of a world group, but must not be the pool that ticks them.
+ * @param deterministic Whether commands deferred by parallel systems are applied in the order
+ *                      of the entities that deferred them, which makes every tick bit for bit
+ *                      identical to a single-threaded one, whatever the number of workers.
+ */
+void ecsSetWorkerPool(ECS *ecs, ECSWorkerPool *pool, bool deterministic);
+
+/**
+ * Destroys an entity once the current system is done running.
+ * @param ecs The ECS registry that `entity` belongs to.
+ * @param entity The handle of the entity to destroy.
+ */
+void ecsDeferDestroy(ECS *ecs, Entity entity);
+
+/**
+ * Adds a component to an entity once the current system is done running.
+ * @param ecs The ECS registry in which the entity and component type are registered.
+ * @param entity The entity to which the component is to be added.
+ * @param id The unique ID of the new component's type.
+ * @param data The component's data, copied right away. Ignored, and can be NULL, for tags and
+ *             bit-packed components.
+ */
+void ecsDeferAdd(ECS *ecs, Entity entity, ECSID id, const void *data);
+
+/**
+ * Removes a component from an entity once the current system is done running.
+ * @param ecs The ECS registry in which the entity and component type are registered.
+ * @param entity The entity for which to remove the component.
+ * @param id The unique ID of the component's type.
+ */
+void ecsDeferRemove(ECS *ecs, Entity entity, ECSID id);
+
+/**
+ * Applies the commands deferred outside of `ecsTick`, for example from `matchEntities`.
+ * @param ecs The ECS registry.
+ */
+void ecsFlushCommands(ECS *ecs);
+
+/**
+ * Run all system in a given ECS registry once. Commands deferred by a system are applied when it
+ * is done. If any component is buffered, the copies written during the tick are published to the
+ * render thread at the end.
  * @param ecs The ECS to advance.
  */
 void ecsTick(ECS *ecs);
 
+/**
+ * Runs a number of ticks back to back, for example to catch up on a server or to train an AI,
+ * only running the systems that belong to one of the given phases. The list of systems to run is
+ * built once, so systems must not be created or destroyed during the run. Buffered components are
+ * only published once, at the end.
+ * @param ecs The ECS to advance.
+ * @param count The number of ticks to run.
+ * @param phases The bitmask of phases to run.
+ */
+void ecsRunTicks(ECS *ecs, uint32_t count, uint32_t phases);
+
+/**
+ * Creates a reference to an entity's component, to be dereferenced with `ecsDeref`.
+ * @param ecs The ECS registry in which the entity exists.
+ * @param entity The entity that has the component.
+ * @param id The unique ID of the component's type.
+ * @return A reference to the component.
+ */
+ComponentRef ecsComponentRef(ECS *ecs, Entity entity, ECSID id);
+
+/**
+ * Returns the current address of a referenced component, like `getComponentID`. The cached address
+ * is used as long as no row of the component's storage has moved or been removed since, and is
+ * looked up again otherwise.
+ * @param ecs The ECS registry in which the entity exists.
+ * @param ref The reference to the component, updated if it had to be looked up again.
+ * @return A pointer to the component's data, or NULL if the entity was destroyed or doesn't have
+ *         the component anymore.
+ */
+void *ecsDeref(ECS *ecs, ComponentRef *ref);
+
+/**
+ * Returns the value of a bit-packed component. Bit-packed values are not part of a component's
+ * row, so they aren't buffered, extracted, replicated, hashed or journaled. They are 0 when the
+ * component is added.
+ * @param ecs The ECS registry in which the entity exists.
+ * @param entity An entity that has the component.
+ * @param id The unique ID of the component's type, declared with `kStorageBits`.
+ * @return The component's value.
+ */
+uint8_t ecsGetBits(const ECS *ecs, Entity entity, ECSID id);
+
+/**
+ * Sets the value of a bit-packed component.
+ * @param ecs The ECS registry in which the entity exists.
+ * @param entity An entity that has the component.
+ * @param id The unique ID of the component's type, declared with `kStorageBits`.
+ * @param value The component's new value, truncated to the component's width.
+ */
+void ecsSetBits(ECS *ecs, Entity entity, ECSID id, uint8_t value);
+
+/**
+ * Creates an owning group for a set of components. Entities that have all of them are kept packed
+ * at the front of each component's storage, in the same order, so that the group can be iterated
+ * as parallel arrays with no lookups. A component can only be owned by one group, and can't be
+ * buffered. Adding and removing owned components costs a few row swaps.
+ * @param ecs The ECS registry.
+ * @param owned The set of components owned by the group.
+ * @return The group's identifier.
+ */
+ECSID ecsNewGroup(ECS *ecs, ComponentMask owned);
+
+/**
+ * Returns the number of entities in a group.
+ * @param ecs The ECS registry.
+ * @param group The group's identifier.
+ * @return The number of entities that have all of the group's components.
+ */
+uint32_t ecsGroupSize(const ECS *ecs, ECSID group);
+
+/**
+ * Returns one of the entities of a group.
+ * @param ecs The ECS registry.
+ * @param group The group's identifier.
+ * @param index The entity's position in the group, less than `ecsGroupSize`.
+ * @return The entity's handle.
+ */
+Entity ecsGroupEntity(const ECS *ecs, ECSID group, uint32_t index);
+
+/**
+ * Returns the packed array of one of a group's components. The component of the entity at a
+ * given position in the group is at the same position in the array. Every row of the group is
+ * considered written. The array is only valid until the group's components are next added or
+ * removed.
+ * @param ecs The ECS registry.
+ * @param group The group's identifier.
+ * @param compID The ID of one of the group's components.
+ * @return The start of the group's array of components.
+ */
+void *ecsGroupComponent(ECS *ecs, ECSID group, uint8_t compID);
+
+/**
+ * Marks a component type as buffered. Buffered components are kept in three copies: one written
+ * by the simulation, one read by the render thread, and one holding the last published tick, so
+ * that reads never block or tear. Only the rows written since a copy was last used are copied
+ * when the copies are flipped.
+ * Pointers returned by `getComponentID` for buffered components are only valid until the end of
+ * the current tick. Components owned by a group can't be buffered.
+ * @param ecs The ECS registry in which the component type is registered.
+ * @param id The unique ID of the component's type.
+ */
+void ecsBufferComponent(ECS *ecs, ECSID id);
+
+/**
+ * Picks up the latest snapshot published by `ecsTick`. Called from the render thread, which
+ * keeps reading the same snapshot until it acquires a new one.
+ * @param ecs The ECS registry to read from.
+ * @return Whether a newer snapshot was acquired.
+ */
+bool ecsAcquireSnapshot(ECS *ecs);
+
+/**
+ * Returns a pointer to a buffered component's data in the snapshot held by the render thread.
+ * @param ecs The ECS registry to read from.
+ * @param index The index of the entity in the component tables.
+ * @param id The unique ID of the buffered component's type.
+ * @return A pointer to the component's data, or NULL if the entity didn't have it in the snapshot.
+ */
+const void *getSnapshotComponentID(const ECS *ecs, Index index, ECSID id);
+
+/**
+ * A single component change read back from an extraction packet.
+ */
+typedef struct {
+    Entity          entity;
+    ECSID           id;
+    size_t          size;
+    const void      *data;  /* NULL if the component or its entity was removed, in which case
+                               `entity` is the handle the entity had at the time. */
+} ECSPacketRecord;
+
+/**
+ * Creates a new, empty extraction packet.
+ * @return A newly allocated packet.
+ */
+ECSPacket *newPacket(void);
+
+/**
+ * Destroys an extraction packet.
+ * @param packet The packet to destroy.
+ */
+void destroyPacket(ECSPacket *packet);
+
+/**
+ * Copies the given components of every entity that changed since the last extraction into a
+ * compact packet, replacing the packet's contents. Meant to be called right after `ecsTick`: the
+ * packet can then be handed to another thread while the next tick runs. The registry only tracks
+ * changes once extraction, replication or journaling starts, so the first extraction reports every
+ * row. From then on, every component type costs a few bytes per entity to track.
+ * @param ecs The ECS registry to extract from.
+ * @param mask The set of component types to extract.
+ * @param packet The packet to fill.
+ * @return The number of records written to the packet.
+ */
+size_t ecsExtract(ECS *ecs, ComponentMask mask, ECSPacket *packet);
+
+/**
+ * Reads the next record from an extraction packet.
+ * @param packet The packet to read from.
+ * @param cursor The read position in the packet, starting at 0.
+ * @param record The record to fill.
+ * @return Whether a record was read, false once the end of the packet is reached.
+ */
+bool readPacket(const ECSPacket *packet, size_t *cursor, ECSPacketRecord *record);
+
+/**
+ * Creates the sender-side state used to replicate a registry to one receiver.
+ * @param mask The set of component types to replicate.
+ * @return A newly allocated replicator.
+ */
+ECSReplicator *newReplicator(ComponentMask mask);
+
+/**
+ * Destroys a replicator.
+ * @param rep The replicator to destroy.
+ */
+void destroyReplicator(ECSReplicator *rep);
+
+/**
+ * Encodes everything that changed in a registry since the replicator's last diff: entities that
+ * were created or destroyed, and replicated components that were added, removed or written.
+ * Written components are sent as the bytes that differ from what the receiver holds, with runs of
+ * unchanged bytes skipped. The first diff holds the whole registry.
+ * Diffs must be applied in order on the receiving end.
+ * @param ecs The ECS registry to replicate.
+ * @param rep The replicator for the receiver.
+ * @param size Receives the size of the diff, in bytes.
+ * @return The diff, owned by `rep` and valid until the next call.
+ */
+const void *ecsWriteDiff(ECS *ecs, ECSReplicator *rep, size_t *size);
+
+/**
+ * Applies a diff written by `ecsWriteDiff` to a registry that mirrors the sender. Entities are
+ * created at the same indices and generations as on the sender, so handles can be shared. The
+ * mirror should not create entities of its own. Diffs are checked as they are applied, and
+ * applying stops at the first malformed record, leaving the records before it applied.
+ * @param ecs The ECS registry to update.
+ * @param diff The diff to apply.
+ * @param size The size of the diff, in bytes.
+ * @return Whether the whole diff was well-formed.
+ */
+bool ecsApplyDiff(ECS *ecs, const void *diff, size_t size);
+
+/**
+ * Starts keeping a running hash of every entity and component in a registry, for example to
+ * detect desyncs in lockstep. Hashing the registry once is done here; afterwards, only the rows
+ * that were written, added or removed are rehashed.
+ * @param ecs The ECS registry to hash.
+ */
+void ecsEnableHashing(ECS *ecs);
+
+/**
+ * Returns the hash of every entity and component in a registry. Two registries with the same
+ * entities and component bytes have the same hash. The cost is proportional to the number of rows
+ * changed since the last call.
+ * @param ecs The ECS registry, in which hashing must have been enabled.
+ * @return The hash of the registry's state.
+ */
+uint64_t ecsWorldHash(ECS *ecs);
+
+/**
+ * Creates an empty journal.
+ * @return A newly allocated journal.
+ */
+ECSJournal *newJournal(void);
+
+/**
+ * Destroys a journal.
+ * @param journal The journal to destroy.
+ */
+void destroyJournal(ECSJournal *journal);
+
+/**
+ * Starts recording every structural change made to a registry (entities created and destroyed,
+ * components added and removed, systems created, destroyed, toggled or moved to other phases, and
+ * the phases each tick ran) into a compact binary journal, along with the bytes of every
+ * component written between ticks. Changes made by systems aren't recorded, since replaying the
+ * journal runs the systems again. The journal starts with the registry's current state.
+ * Journaling is not compatible with entities being created from several threads.
+ * @param ecs The ECS registry to record.
+ * @param journal The journal to record into, or NULL to stop recording.
+ */
+void ecsSetJournal(ECS *ecs, ECSJournal *journal);
+
+/**
+ * Returns the contents of a journal, to be saved or passed to `ecsReplay`.
+ * @param journal The journal.
+ * @param size Receives the size of the journal, in bytes.
+ * @return The journal's contents, valid until the journal is recorded into again.
+ */
+const void *journalData(const ECSJournal *journal, size_t *size);
+
+/**
+ * Replays a journal into an empty registry, as fast as possible, calling `ecsTick` or
+ * `ecsRunTicks` wherever a tick was recorded. Component types are declared with the storage they
+ * were recorded with. System functions can't be recorded: for every system in the journal,
+ * `resolve` is called with the system's recorded handle and mask, and should create a matching
+ * system, whose recorded state changes are then replayed. Entities created by systems are
+ * expected at the same indices as when recording, which holds for deterministic systems and a
+ * journal recorded from an empty registry.
+ * @param ecs The ECS registry to replay into.
+ * @param data The journal's contents.
+ * @param size The size of the journal, in bytes.
+ * @param resolve A function called for each recorded system, or NULL.
+ * @param userData An arbitrary pointer passed to `resolve`.
+ */
+void ecsReplay(ECS *ecs, const void *data, size_t size, ECSSystemResolver resolve, void *userData);
+
+/**
+ * Calls a function for each entity that contains the given buffered components in the snapshot
+ * held by the render thread.
+ * @param ecs The ECS registry to read from.
+ * @param mask A set of buffered component types that entities must contain to match.
+ * @param func A function to call for each entity index matching `mask`.
+ * @param data An arbitrary pointer passed to `func`.
+ */
+void matchSnapshot(const ECS *ecs, ComponentMask mask, ECSSnapshotIterator func, void *data);
+
+/**
+ * Memory used by one component type's storage in a registry.
+ */
+typedef struct {
+    size_t          data;       /* Bytes used by the component's table, and its snapshot copies. */
+    size_t          indices;    /* Bytes used to track changes and snapshots. */
+    size_t          live;       /* Number of entities that have the component. */
+    size_t          capacity;   /* Number of entities the table can hold. */
+} ECSComponentStats;
+
+/**
+ * Memory used by an ECS registry, broken down by what it is used for.
+ */
+typedef struct {
+    size_t              total;
+    size_t              entities;
+    size_t              systems;
+    size_t              indices;
+    size_t              liveEntities;
+    size_t              entityCapacity;
+    ECSComponentStats   components[ECS_MAX_COMPS];
+} ECSMemoryStats;
+
+/**
+ * Reports how much memory an ECS registry uses, and how full its tables are.
+ * @param ecs The ECS registry to inspect.
+ * @param stats The statistics to fill. Component types that have no table in `ecs` are zeroed.
+ */
+void ecsMemoryStats(const ECS *ecs, ECSMemoryStats *stats);
+
+/**
+ * Creates a pool of worker threads. Without `ECS_THREADS`, the pool runs jobs on the calling thread.
+ * @param threads The number of worker threads to start.
+ * @return A newly allocated worker pool.
+ */
+ECSWorkerPool *newWorkerPool(unsigned threads);
+
+/**
+ * Stops the threads of a worker pool and destroys it.
+ * @param pool The worker pool to destroy.
+ */
+void destroyWorkerPool(ECSWorkerPool *pool);
+
+/**
+ * Returns the number of workers in a pool.
+ * @param pool The worker pool.
+ * @return The number of workers that can run jobs at the same time.
+ */
+unsigned workerPoolSize(const ECSWorkerPool *pool);
+
+/**
+ * Runs a job `count` times across the workers of a pool, and waits for all of them to finish.
+ * Runs started from several threads at once take turns. A job must not start a run on the pool
+ * that runs it.
+ * @param pool The worker pool to run the job on.
+ * @param count The number of times to run the job.
+ * @param job The function to run. It is passed the job's index, the index of the worker running
+ *            it, and `data`.
+ * @param data An arbitrary pointer passed to `job`.
+ */
+void workerPoolRun(ECSWorkerPool *pool, unsigned count, ECSJob job, void *data);
+
+/**
+ * Creates a group of ECS registries that are ticked together on a worker pool.
+ * @param pool The worker pool used to tick the group's registries.
+ * @return A newly allocated world group.
+ */
+ECSWorldGroup *newWorldGroup(ECSWorkerPool *pool);
+
+/**
+ * Destroys a world group. The registries in the group are not destroyed.
+ * @param group The world group to destroy.
+ */
+void destroyWorldGroup(ECSWorldGroup *group);
+
+/**
+ * Adds an ECS registry to a world group.
+ * @param group The world group.
+ * @param ecs The ECS registry to add.
+ */
+void worldGroupAdd(ECSWorldGroup *group, ECS *ecs);
+
+/**
+ * Removes an ECS registry from a world group.
+ * @param group The world group.
+ * @param ecs The ECS registry to remove.
+ */
+void worldGroupRemove(ECSWorldGroup *group, ECS *ecs);
+
+/**
+ * Sets whether an ECS registry in a world group gets ticked. Idle worlds cost nothing.
+ * @param group The world group.
+ * @param ecs The ECS registry to enable or disable.
+ * @param active Whether `ecs` should be ticked by `worldGroupTick`.
+ */
+void worldGroupSetActive(ECSWorldGroup *group, ECS *ecs, bool active);
+
+/**
+ * Ticks every active registry in a world group once, in parallel. Each world is scheduled on the
+ * worker that last ran it unless that worker is overloaded, based on the measured cost of each
+ * world's previous ticks. Workers that run out of worlds take them from others.
+ * @param group The world group to tick.
+ */
+void worldGroupTick(ECSWorldGroup *group);
+
 
 #ifdef __cplusplus
 }
@@ -52,10 +52,10 @@ int main() {
     speed->y = 0.2;
     
     // Create systems that operate on component sets
-    ECSID physics = newSystem(world, componentMask(2, kPosition, kSpeed), moveEntities, NULL);
+    ECSSystem physics = newSystem(world, componentMask(2, kPosition, kSpeed), moveEntities, NULL);
     
     // If needed, you can remove systems
-    destroySystem(ecs, physics);
+    destroySystem(world, physics);
     
     // Every frame, advance your ECS world
     ecsTick(world);
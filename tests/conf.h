@@ -0,0 +1 @@
+// Configuration for the tests. Individual tests override it from the Makefile.
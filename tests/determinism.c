@@ -0,0 +1,82 @@
+// Determinism test: the same simulation is run serially, then with parallel systems on 1, 2, 4
+// and 8 workers in deterministic mode. The world hash after every tick must match bit for bit.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ecs.h"
+
+typedef struct {
+    float x, v;
+} Body;
+
+typedef struct {
+    int kind;
+} Tag;
+
+static ECSID kBody, kTag;
+
+static void integrate(ECS *ecs, Entity entity, void *userData) {
+    (void)userData;
+    Body *body = getComponentID(ecs, entity, kBody);
+    body->x += body->v;
+    body->v *= 0.99f;
+}
+
+// Makes structural changes through deferred commands, whose order depends on the entity order.
+static void decide(ECS *ecs, Entity entity, void *userData) {
+    (void)userData;
+    const Body *body = readComponentID(ecs, entity, kBody);
+    int kind = (int)(body->x * 1000) & 15;
+    if(kind == 0) {
+        ecsDeferDestroy(ecs, entity);
+    } else if(kind < 4) {
+        Tag tag = { kind };
+        ecsDeferAdd(ecs, entity, kTag, &tag);
+    } else if(kind < 6) {
+        ecsDeferRemove(ecs, entity, kTag);
+    }
+}
+
+// Returns a hash of the world's hashes after each tick.
+static uint64_t run(unsigned workers) {
+    ECS *ecs = newECS();
+    kBody = ECS_COMPONENT(ecs, Body);
+    kTag = ECS_COMPONENT(ecs, Tag);
+    ecsEnableHashing(ecs);
+    
+    srand(7);
+    for(int i = 0; i < ECS_MAX_ENTITIES / 2; ++i) {
+        Body *body = addComponentID(ecs, newEntity(ecs), kBody);
+        body->x = (rand() % 100) / 7.f;
+        body->v = (rand() % 10) / 3.f;
+    }
+    
+    ECSWorkerPool *pool = workers ? newWorkerPool(workers) : NULL;
+    ECSSystem integrateSystem = newSystem(ecs, 1 << kBody, integrate, NULL);
+    ECSSystem decideSystem = newSystem(ecs, 1 << kBody, decide, NULL);
+    if(pool) {
+        ecsSetSystemParallel(ecs, integrateSystem, true);
+        ecsSetSystemParallel(ecs, decideSystem, true);
+        ecsSetWorkerPool(ecs, pool, true);
+    }
+    
+    uint64_t hash = 0;
+    for(int tick = 0; tick < 50; ++tick) {
+        ecsTick(ecs);
+        hash = hash * 31 + ecsWorldHash(ecs);
+    }
+    destroyECS(ecs);
+    if(pool) destroyWorkerPool(pool);
+    return hash;
+}
+
+int main(void) {
+    int failures = 0;
+    uint64_t serial = run(0);
+    for(unsigned workers = 1; workers <= 8; workers *= 2) {
+        bool same = run(workers) == serial;
+        printf("determinism: %u workers %s\n", workers, same ? "match" : "differ");
+        if(!same) failures += 1;
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+// Journal replay test: a world is changed from outside and by systems, in every phase, while
+// systems are toggled and destroyed. Replaying its journal into an empty world must end in the
+// same state.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ecs.h"
+
+typedef struct {
+    int x;
+} Counter;
+
+static ECSID kCounter;
+static int failures = 0;
+
+static void addOne(ECS *ecs, Entity entity, void *userData) {
+    (void)userData;
+    getComponent(ecs, entity, Counter)->x += 1;
+}
+
+static void addTen(ECS *ecs, Entity entity, void *userData) {
+    (void)userData;
+    getComponent(ecs, entity, Counter)->x += 10;
+}
+
+static void addHundred(ECS *ecs, Entity entity, void *userData) {
+    (void)userData;
+    getComponent(ecs, entity, Counter)->x += 100;
+}
+
+// Recreates the recorded systems, which are always created in this order.
+static void resolveSystem(ECS *ecs, ECSSystem system, ComponentMask mask, void *userData) {
+    (void)system;
+    static ECSIterator *const funcs[] = { addOne, addTen, addHundred };
+    int *created = userData;
+    newSystem(ecs, mask, funcs[(*created)++], NULL);
+}
+
+static void sumCounters(ECS *ecs, Entity entity, void *userData) {
+    *(long *)userData += readComponent(ecs, entity, Counter)->x;
+}
+
+static ECS *replay(const ECSJournal *journal) {
+    size_t size;
+    const void *data = journalData(journal, &size);
+    ECS *ecs = newECS();
+    ecsEnableHashing(ecs);
+    int created = 0;
+    ecsReplay(ecs, data, size, resolveSystem, &created);
+    return ecs;
+}
+
+static void compare(const char *name, ECS *recorded, ECS *replayed) {
+    long recordedSum = 0, replayedSum = 0;
+    matchEntities(recorded, 1 << kCounter, sumCounters, &recordedSum);
+    matchEntities(replayed, 1 << kCounter, sumCounters, &replayedSum);
+    if(recordedSum != replayedSum || ecsWorldHash(recorded) != ecsWorldHash(replayed)) {
+        printf("journal: %s recorded %ld, replayed %ld\n", name, recordedSum, replayedSum);
+        failures += 1;
+    }
+}
+
+// Systems' writes must only be applied once: five ticks of x += 1 replay to 5.
+static void testSystemWrites(void) {
+    ECS *ecs = newECS();
+    ecsEnableHashing(ecs);
+    kCounter = ECS_COMPONENT(ecs, Counter);
+    ECSJournal *journal = newJournal();
+    ecsSetJournal(ecs, journal);
+    
+    newSystem(ecs, 1 << kCounter, addOne, NULL);
+    addComponent(ecs, newEntity(ecs), Counter)->x = 0;
+    for(int tick = 0; tick < 5; ++tick) ecsTick(ecs);
+    ecsSetJournal(ecs, NULL);
+    
+    ECS *replayed = replay(journal);
+    compare("system writes", ecs, replayed);
+    destroyECS(replayed);
+    destroyJournal(journal);
+    destroyECS(ecs);
+}
+
+static void testSystemsAndPhases(void) {
+    ECS *ecs = newECS();
+    ecsEnableHashing(ecs);
+    ECSJournal *journal = newJournal();
+    ecsSetJournal(ecs, journal);
+    
+    ECSSystem one = newSystem(ecs, 1 << kCounter, addOne, NULL);
+    ECSSystem ten = newSystem(ecs, 1 << kCounter, addTen, NULL);
+    ECSSystem hundred = newSystem(ecs, 1 << kCounter, addHundred, NULL);
+    ecsSetSystemPhase(ecs, ten, 2);
+    
+    Entity entities[ECS_MAX_ENTITIES];
+    int count = 0;
+    srand(2);
+    for(int tick = 0; tick < 200; ++tick) {
+        for(int i = 0; i < 4; ++i) {
+            int op = rand() % 5;
+            if(op < 2 && count < ECS_MAX_ENTITIES / 2) {
+                entities[count] = newEntity(ecs);
+                addComponent(ecs, entities[count++], Counter)->x = rand() % 100;
+            } else if(op == 2 && count > 0) {
+                int index = rand() % count;
+                destroyEntity(ecs, entities[index]);
+                entities[index] = entities[--count];
+            } else if(op == 3 && count > 0) {
+                getComponent(ecs, entities[rand() % count], Counter)->x = rand() % 100;
+            }
+        }
+        
+        if(tick == 50) ecsEnableSystem(ecs, hundred, false);
+        if(tick == 80) ecsEnableSystem(ecs, hundred, true);
+        if(tick == 120) destroySystem(ecs, hundred);
+        if(tick == 150) ecsSetSystemPhase(ecs, one, 2);
+        if(tick % 3) {
+            ecsTick(ecs);
+        } else {
+            ecsRunTicks(ecs, 2, tick % 2 ? 1 : 2);
+        }
+    }
+    ecsSetJournal(ecs, NULL);
+    
+    ECS *replayed = replay(journal);
+    compare("systems and phases", ecs, replayed);
+    destroyECS(replayed);
+    destroyJournal(journal);
+    destroyECS(ecs);
+}
+
+int main(void) {
+    testSystemWrites();
+    testSystemsAndPhases();
+    printf("journal: %d failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+// Loopback replication test: random changes are made to a source world, and each tick's diff is
+// applied to a replica. Both worlds must then hold the same entities and components.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ecs.h"
+
+typedef struct {
+    float x, y;
+    int padding[6];
+} Position;
+
+typedef struct {
+    int hp;
+} Health;
+
+static ECS *source, *replica;
+static ECSID kPosition, kHealth;
+static int failures = 0;
+
+static void compareEntity(ECS *ecs, Entity entity, void *userData) {
+    (void)ecs;
+    (void)userData;
+    if(!isEntityValid(replica, entity)) {
+        failures += 1;
+        return;
+    }
+    
+    ECSID ids[2] = { kPosition, kHealth };
+    size_t sizes[2] = { sizeof(Position), sizeof(Health) };
+    for(int i = 0; i < 2; ++i) {
+        const void *a = readComponentID(source, entity, ids[i]);
+        const void *b = readComponentID(replica, entity, ids[i]);
+        if(!a != !b || (a && memcmp(a, b, sizes[i]))) failures += 1;
+    }
+}
+
+static void countEntity(ECS *ecs, Entity entity, void *userData) {
+    (void)ecs;
+    (void)entity;
+    *(int *)userData += 1;
+}
+
+int main(void) {
+    source = newECS();
+    replica = newECS();
+    kPosition = ECS_COMPONENT(source, Position);
+    kHealth = ECS_COMPONENT(source, Health);
+    ECSReplicator *replicator = newReplicator((1 << kPosition) | (1 << kHealth));
+    ecsEnableHashing(source);
+    ecsEnableHashing(replica);
+    
+    Entity entities[ECS_MAX_ENTITIES];
+    int count = 0;
+    size_t total = 0;
+    srand(1);
+    
+    for(int tick = 0; tick < 500; ++tick) {
+        for(int i = 0; i < 10; ++i) {
+            int op = rand() % 6;
+            if(op == 0 && count < ECS_MAX_ENTITIES - 8) {
+                entities[count++] = newEntity(source);
+            } else if(op == 1 && count > 0) {
+                int index = rand() % count;
+                destroyEntity(source, entities[index]);
+                entities[index] = entities[--count];
+            } else if(op == 2 && count > 0) {
+                Position *position = addComponentID(source, entities[rand() % count], kPosition);
+                memset(position, 0, sizeof(*position));
+                position->x = rand() % 100;
+            } else if(op == 3 && count > 0) {
+                Health *health = addComponentID(source, entities[rand() % count], kHealth);
+                health->hp = rand();
+            } else if(op == 4 && count > 0) {
+                removeComponentID(source, entities[rand() % count], rand() % 2 ? kPosition : kHealth);
+            } else if(op == 5 && count > 0) {
+                Position *position = getComponentID(source, entities[rand() % count], kPosition);
+                if(position) position->y += 1;
+            }
+        }
+        ecsTick(source);
+        
+        size_t size;
+        const void *diff = ecsWriteDiff(source, replicator, &size);
+        if(!ecsApplyDiff(replica, diff, size)) failures += 1;
+        total += size;
+        
+        // A truncated diff must be rejected, without touching memory past its end.
+        if(tick % 50 == 0 && size > 1) {
+            ECS *scratch = newECS();
+            if(ecsApplyDiff(scratch, diff, rand() % (size - 1))) failures += 1;
+            destroyECS(scratch);
+        }
+        
+        matchEntities(source, 0, compareEntity, NULL);
+        int sourceCount = 0, replicaCount = 0;
+        matchEntities(source, 0, countEntity, &sourceCount);
+        matchEntities(replica, 0, countEntity, &replicaCount);
+        if(sourceCount != replicaCount) failures += 1;
+        if(ecsWorldHash(source) != ecsWorldHash(replica)) failures += 1;
+    }
+    
+    printf("replicate: %d failures, %zu bytes of diffs\n", failures, total);
+    destroyReplicator(replicator);
+    destroyECS(source);
+    destroyECS(replica);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}